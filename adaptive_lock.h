@@ -0,0 +1,147 @@
+/**
+ * Copyright (c) 2012 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+#ifndef _ADAPTIVE_LOCK_H
+#define _ADAPTIVE_LOCK_H
+
+#include <stdint.h>
+#include <sched.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// adaptive_lock.h - A small mutex for the allocator's short critical sections.
+//
+// A thread that finds the lock taken first spins on it for a while, pausing for exponentially longer between
+// looks, and only then parks in the kernel (a futex wait) until the holder wakes it. How long it spins adapts
+// to each lock: it follows the number of looks that recent acquisitions needed, and stays short on locks that
+// are held too long for spinning to pay. Locks set up without spinning (on a single CPU, where the holder cannot
+// run while the waiter spins) park straight away. The lock is not recursive.
+//
+// The state is 0 when the lock is free, 1 when it is held, and 2 when it is held and a thread may be parked on
+// it, which tells the holder to wake one up when it releases the lock.
+
+// The most looks a thread takes at a contended lock before it parks
+#define ADAPTIVE_LOCK_MAXIMUM_SPINS 100
+
+// The most pause instructions between two looks
+#define ADAPTIVE_LOCK_MAXIMUM_BACKOFF 64
+
+// The running average of the looks is kept in fixed point, scaled by 2^ADAPTIVE_LOCK_ESTIMATE_SHIFT, and each
+// acquisition moves it by 1/2^ADAPTIVE_LOCK_ESTIMATE_SHIFT of the way to its own count. Kept unscaled, moves smaller
+// than a whole look would round to nothing, and the average would stall short of small counts.
+#define ADAPTIVE_LOCK_ESTIMATE_SHIFT 3
+
+namespace my {
+
+// A lock, with counters of how often it was taken, found taken and slept on. The counters are only written by
+// the holder. A zeroed lock is free and parks straight away.
+struct AdaptiveLock {
+  volatile int state;
+  int maximumSpins; // the most looks before parking; 0 parks straight away
+  int spinEstimate; // running average of the looks that contended acquisitions needed, in fixed point
+  uint64_t acquisitions;
+  uint64_t contentions; // acquisitions that found the lock taken
+  uint64_t parks; // times a thread slept on the lock
+};
+
+// Sets up a free lock. Spinning only pays when the holder can run while another thread waits.
+static inline void adaptiveLockInit(AdaptiveLock * lock, bool canSpin) {
+  lock->state = 0;
+  lock->maximumSpins = canSpin ? ADAPTIVE_LOCK_MAXIMUM_SPINS : 0;
+  lock->spinEstimate = 0;
+  lock->acquisitions = 0;
+  lock->contentions = 0;
+  lock->parks = 0;
+}
+
+// Helper method that waits for a short while without giving up the CPU
+static inline void adaptiveLockPause(int pauses) {
+  for (int i = 0; i < pauses; i++) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+  }
+}
+
+// Helper method that sleeps as long as the lock's state is 2
+static inline void adaptiveLockPark(AdaptiveLock * lock) {
+#ifdef __linux__
+  syscall(SYS_futex, &(lock->state), FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+#else
+  sched_yield();
+#endif
+}
+
+// Helper method that wakes up one thread parked on the lock
+static inline void adaptiveLockWake(AdaptiveLock * lock) {
+#ifdef __linux__
+  syscall(SYS_futex, &(lock->state), FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#endif
+}
+
+// Helper method that takes a lock that was found taken: spins, then parks
+static inline void adaptiveLockSlow(AdaptiveLock * lock) {
+  int spinLimit = 2 * (lock->spinEstimate >> ADAPTIVE_LOCK_ESTIMATE_SHIFT) + 10;
+  spinLimit = (spinLimit < lock->maximumSpins) ? spinLimit : lock->maximumSpins;
+  int backoff = 1;
+  int spins = 0;
+  for (; spins < spinLimit; spins++) {
+    adaptiveLockPause(backoff);
+    backoff = (backoff < ADAPTIVE_LOCK_MAXIMUM_BACKOFF) ? 2 * backoff : ADAPTIVE_LOCK_MAXIMUM_BACKOFF;
+    if (lock->state == 0 && __sync_bool_compare_and_swap(&(lock->state), 0, 1)) {
+      break;
+    }
+  }
+  uint64_t parks = 0;
+  if (spins == spinLimit) {
+    // Whoever takes the lock from here on cannot tell whether other threads are parked, so it wakes one
+    while (__atomic_exchange_n(&(lock->state), 2, __ATOMIC_ACQUIRE) != 0) {
+      adaptiveLockPark(lock);
+      parks++;
+    }
+  }
+  // Spinning that ended in a park was wasted, so it pulls the estimate down
+  lock->spinEstimate += (parks ? 0 : spins) - (lock->spinEstimate >> ADAPTIVE_LOCK_ESTIMATE_SHIFT);
+  lock->contentions++;
+  lock->parks += parks;
+}
+
+// Takes the lock
+static inline void adaptiveLock(AdaptiveLock * lock) {
+  if (!__sync_bool_compare_and_swap(&(lock->state), 0, 1)) {
+    adaptiveLockSlow(lock);
+  }
+  lock->acquisitions++;
+}
+
+// Releases the lock, waking a parked thread if there may be one
+static inline void adaptiveUnlock(AdaptiveLock * lock) {
+  if (__atomic_exchange_n(&(lock->state), 0, __ATOMIC_RELEASE) == 2) {
+    adaptiveLockWake(lock);
+  }
+}
+
+};
+#endif  // _ADAPTIVE_LOCK_H
@@ -27,13 +27,26 @@
 #include <cstring>
 #include <cmath>
 #include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <iostream>
 #include "./allocator_interface.h"
 #include "./memlib.h"
 #include "./benchmarks/cpuinfo.h"
+#include "./adaptive_lock.h"
+#include "./pagemap.h"
+#include "./size_classes.h"
+#ifdef PER_CPU_CACHES
+#include "./percpu.h"
+#endif
 
-// All blocks must have a specified minimum alignment.
+// All blocks must have a specified minimum alignment. Builds that stand in for the system malloc
+// (see preload.cpp) raise it to 16 to match the alignment guaranteed by the platform ABI.
+#ifndef ALIGNMENT
 #define ALIGNMENT 8
+#endif
 
 // Rounds up to the nearest multiple of ALIGNMENT.
 #define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(ALIGNMENT-1))
@@ -48,14 +61,39 @@ struct MemoryBlock {
   void * threadInfo; // a pointer to the shared information of the thread that owns this block
   uint32_t size; // size of the entire memory block including the header and the footer
   bool isFree; // flag indicating whether this memory block is in use or had been freed
-  MemoryBlock * nextFreeBlock; // pointer to the next free block in the binned free list that this belongs to.
+  bool isPurged; // for spans in the span pool: whether the pages inside them have been handed back to the kernel
+#ifdef LIFETIME_HEAPS
+  bool isLongLived; // whether the block belongs to the long-lived heap of its owner
+  uint8_t site; // for allocated blocks: the allocation site that they count as live at, or 0 if none
+#endif
+  union {
+    MemoryBlock * nextFreeBlock; // pointer to the next free block in the binned free list that this belongs to.
+    size_t spanIndex; // with SPAN_DESCRIPTORS, for spans in the span pool: the index of the span's descriptor
+  };
   MemoryBlock * previousFreeBlock; // pointer to the previous free block in the binned free list that this belongs to.
 };
 
-// Thread-specific variables that need to be shared with other threads
+// Thread-specific variables that need to be shared with other threads. The record outlives its thread: blocks that
+// are still allocated keep pointing at it, and a new thread later takes it over together with those blocks.
 struct ThreadSharedInfo {
-  pthread_mutex_t localLock;
+  AdaptiveLock localLock;
   MemoryBlock * unbinnedBlocks;
+  int node; // the NUMA node that the thread's heap comes from
+  bool hasExited; // whether the thread has exited and the record waits to be taken over
+  volatile uint64_t operations; // number of calls to malloc and free the thread has made
+  uint64_t operationsSeen; // value of operations at the background thread's previous pass
+  volatile size_t cacheLimit; // most bytes the thread keeps in its bins before it hands the excess to the span pool
+  ThreadSharedInfo * nextThread; // next record in the registry of all records
+  ThreadSharedInfo * nextExitedThread; // next record waiting to be taken over
+};
+
+// Blocks freed by the current thread that wait to be handed over to their owner together. They are linked like
+// the unbinned list they join, and stay marked as allocated.
+struct RemoteFreeBatch {
+  ThreadSharedInfo * owner;
+  MemoryBlock * head;
+  MemoryBlock * tail;
+  int count;
 };
 
 // A footer that will follow ever allocated memory block
@@ -70,8 +108,32 @@ typedef uint32_t MemoryBlockFooter;
 // The minimum total block size (including overhead) of any memory block that can allocated
 #define MINIMUM_ALLOCATED_BLOCK_SIZE ALIGN(FREE_BLOCK_OVERHEAD)
 
-#define BIN_INDEX_THRESHOLD 1024
-#define NUM_OF_BINS 150
+// Block sizes below SIZE_CLASS_LIMIT are binned by the size classes profiled into size_classes.h (see
+// sizeclasses.py), and larger ones by their power of two
+#define NUM_OF_BINS (SIZE_CLASS_COUNT + 32 - SIZE_CLASS_LIMIT_SHIFT)
+
+#ifdef LIFETIME_HEAPS
+// Each thread keeps small blocks that are predicted to be long-lived in a heap of their own: a second set of bins,
+// whose blocks only coalesce with each other, so that the few blocks that outlive their neighbours do not pin the
+// memory that short-lived blocks free up. Lifetimes are predicted per allocation site, the return address of
+// malloc hashed into one of ALLOCATION_SITES - 1 entries. A thread counts the blocks allocated at each site, and
+// those of them still live; by Little's law, live / allocated * mallocs is the mean lifetime of the site's blocks,
+// in calls to malloc. Once a site has ALLOCATION_SITE_SAMPLES blocks, it is long-lived if that lifetime is at least
+// LONG_LIVED_LIFETIME. The counts of allocations are halved every ALLOCATION_SITE_WINDOW calls to malloc, so that
+// predictions follow the phases of the program.
+#define ALLOCATION_SITES 256
+#define ALLOCATION_SITE_SAMPLES 16
+#define ALLOCATION_SITE_WINDOW (64 * 1024)
+#define LONG_LIVED_LIFETIME 1024
+
+// A long-lived block that finds nothing in the long-lived bins takes this much more fresh memory, which is binned in
+// the long-lived heap for the blocks that follow it
+#define LONG_LIVED_REGION_SIZE (4 * 1024)
+
+#define NUM_OF_THREAD_BINS (2 * NUM_OF_BINS)
+#else
+#define NUM_OF_THREAD_BINS NUM_OF_BINS
+#endif
 
 // A minimum threshold of gained free space for which a memory block will be truncated before it is allocated
 #define FREE_BLOCK_SPLIT_THRESHOLD 8
@@ -79,6 +141,77 @@ typedef uint32_t MemoryBlockFooter;
 // The initial amount of memory that is made available to a thread's local heap when a thread is initialized
 #define INITIAL_ALLOCATION_PER_THREAD 64
 
+// The size of the first region a thread takes when it grows the heap while another thread's blocks end it,
+// and the cap that each thread's doubling region size is held to
+#define INITIAL_REGION_SIZE (16 * 1024)
+#define MAXIMUM_REGION_SIZE (128 * 1024)
+
+// Regions and spans that a thread takes start on a cache line of their own, so that its first blocks never share
+// a line with another thread's. Successive regions are further offset by one of REGION_COLORS lines in turn, so
+// that regions which all start on a page boundary do not all map to the same cache sets. CACHE_LINE_SIZE is defined
+// in allocator_interface.h.
+#define REGION_COLORS 8
+
+// The times a thread looks again for a reservation of the end of the heap to be published before it yields
+#define HEAP_RESERVATION_SPINS 32
+
+// Free spans at least this big are handed to the span pool rather than kept by the thread that owns them
+#define SPAN_POOL_THRESHOLD (32 * 1024)
+
+// Blocks at least this big (including overhead) are large: they are served by the span pool, which acts as a page
+// heap shared by all threads, and go straight back to it when they are freed. Their sizes are rounded up to whole
+// pages, so that the spans they leave behind split and coalesce in whole pages too.
+#define LARGE_BLOCK_THRESHOLD SPAN_POOL_THRESHOLD
+#define LARGE_BLOCK_UNIT ((size_t) 1 << PAGE_MAP_PAGE_SHIFT)
+
+// Thread records are carved out of slabs of this size, which are mapped outside of the heap and never unmapped
+#define THREAD_RECORD_SLAB_SIZE (64 * 1024)
+
+// Spans in the span pool at least this big have their pages handed back to the kernel by the background thread
+#define PURGE_THRESHOLD (64 * 1024)
+
+// A free span at least this big that ends the heap is cut off it by the background thread, and its pages are
+// decommitted, so that the memory committed to the heap shrinks along with the heap
+#define TRIM_THRESHOLD (256 * 1024)
+
+// The largest block that coalescing may produce, so that block sizes still fit in 32 bits
+#define MAXIMUM_COALESCED_SIZE ((size_t) 1 << 31)
+
+// The most blocks from the unbinned list that one call to malloc or free bins, so that no call pays for all the
+// blocks that other threads have freed back to this one at once
+#define UNBINNED_BLOCK_BUDGET 64
+
+// Small blocks that a thread frees on behalf of other threads are collected per owner and handed over
+// REMOTE_FREE_BATCH at a time, under a single acquisition of the owner's local lock. A thread collects for up to
+// REMOTE_FREE_SLOTS owners at once; an owner that maps to a slot taken by another owner gets the slot once the
+// blocks already in it have been handed over. A batch that is not full yet is handed over when the thread exits or
+// calls drain_remote_frees, and on its first call to malloc or free after each pass of the background thread. So
+// while the background thread runs, a thread that keeps calling the allocator holds a partial batch for at most
+// about one interval; a thread that makes no further call holds at most REMOTE_FREE_SLOTS * (REMOTE_FREE_BATCH - 1)
+// blocks until it exits.
+#define REMOTE_FREE_BATCH 32
+#define REMOTE_FREE_SLOTS 8
+
+// Each thread keeps at most its cache limit in free blocks in its bins; the excess is handed to the span pool. The
+// limit starts at THREAD_CACHE_MINIMUM and follows demand: each time a thread has to take memory from the span pool
+// or the heap, the limit grows by what it took, and after THREAD_CACHE_EPOCH calls to malloc without taking any,
+// it is halved. The background thread cuts the limits of idle threads back to the minimum. The growth of all limits
+// together is held to THREAD_CACHE_BUDGET.
+#define THREAD_CACHE_MINIMUM (64 * 1024)
+#define THREAD_CACHE_BUDGET ((size_t) 64 * 1024 * 1024)
+#define THREAD_CACHE_EPOCH (64 * 1024)
+
+// The largest request that can be served; block sizes are stored in 32 bits and mem_sbrk takes an int
+#define MAXIMUM_REQUEST_SIZE ((size_t) 1 << 30)
+
+#ifdef PER_CPU_CACHES
+// Freed blocks up to this size (including overhead) are kept in the caches of the CPU they were freed on, one
+// class per aligned size, and handed straight to the next malloc of that size on that CPU
+#define PER_CPU_MAXIMUM_BLOCK_SIZE 256
+#define PER_CPU_NUM_CLASSES ((PER_CPU_MAXIMUM_BLOCK_SIZE - MINIMUM_ALLOCATED_BLOCK_SIZE) / ALIGNMENT + 1)
+#define PER_CPU_CACHE_CAPACITY 32
+#endif
+
 // Formula which, given a MemoryBlock pointer, returns the internal space address (of the MemoryBlock) that should be visible to the user
 #define MB_ADDRESS_TO_INTERNAL_SPACE_ADDRESS(mbptr) ((void *) ((char *)(mbptr) + sizeof(MemoryBlock) - 2 * sizeof(MemoryBlock *)))
 
@@ -91,20 +224,111 @@ typedef uint32_t MemoryBlockFooter;
 // Formula which, given a pointer to the beginning of an internal allocated space, returns the corresponding MemoryBlock pointer
 #define INTERNAL_SPACE_ADDRESS_TO_MB_ADDRESS(ptr) (MemoryBlock *) ((char *) (ptr) + 2 * sizeof(MemoryBlock *) - sizeof(MemoryBlock))
 
+// The most NUMA nodes that get an arena of their own
+#define MAXIMUM_NUMA_NODES 64
+
+#ifdef SPAN_DESCRIPTORS
+// The free spans of a span pool are described in a dense array of descriptors kept outside of the heap, rather
+// than linked through their headers. Looking for a span or for spans to purge then reads only the array, and never
+// the spans themselves, so their pages can be freed lazily (MADV_FREE) and stay out of the cache until they are
+// taken. A span's header still holds its size, owner and the index of its descriptor, for its neighbours.
+struct SpanDescriptor {
+  MemoryBlock * span;
+  uint32_t size;
+  bool isPurged;
+};
+
+// The array starts out this big, in descriptors, and doubles whenever it fills up
+#define SPAN_DESCRIPTORS_INITIAL_CAPACITY 256
+#endif
+
+// A pool of large free spans that any thread can take over, one per NUMA node. Spans in a pool are owned by the
+// pool itself (their threadInfo points at it), so no thread coalesces with them or bins them.
+struct SpanPool {
+  AdaptiveLock lock;
+  size_t freeBytes; // total size of the spans in the pool, read without the lock as a hint
+#ifdef SPAN_DESCRIPTORS
+  SpanDescriptor * spans; // mapped outside of the heap, and kept across calls to init
+  size_t numSpans;
+  size_t spanCapacity;
+#else
+  MemoryBlock * bins[NUM_OF_BINS];
+#endif
+};
+
 void * memoryStart;
-void * endOfHeap;
-pthread_mutex_t globalLock;
-pthread_mutexattr_t globalLockAttr;
+// The end of the heap that other threads may coalesce up to. It only moves once the headers below it are set up,
+// and it trails memlib's brk only while a thread is setting up the memory it reserved there (see growHeap).
+void * volatile endOfHeap;
+void * heapTailOwner; // threadInfo of the block that ends the heap; only written while the brk is reserved
+// Maps every page of the heap to the threadInfo of the block that holds the first byte of the page: the thread or
+// span pool that owns it. Kept up to date wherever memory changes hands (growHeap, donateSpan, takeSpan and realloc),
+// and read by owns. Entries past endOfHeap may be left over from an earlier heap; growHeap overwrites them before
+// they are reached.
+PageMap pageMap;
+AdaptiveLock globalLock; // guards the thread records; heap growth takes no lock
+bool canSpinOnLocks; // whether the allocator's locks spin before parking, which only pays with more than one CPU
+SpanPool spanPools[MAXIMUM_NUMA_NODES];
+int numaNodes;
+pthread_key_t threadExitKey;
+pthread_once_t threadExitKeyOnce = PTHREAD_ONCE_INIT;
+static void createThreadExitKey();
+
+#ifdef PER_CPU_CACHES
+// Blocks in the per-CPU caches stay allocated as far as the heap is concerned, and keep their owner thread
+PerCpuCache<PER_CPU_NUM_CLASSES, PER_CPU_CACHE_CAPACITY> perCpuCaches[PERCPU_MAXIMUM_CPUS];
+bool perCpuCachesEnabled;
+#endif
+
+// The registry of thread records, guarded by the global lock. Records are only ever added to it, so the
+// background thread can walk it without the lock.
+ThreadSharedInfo * volatile threadRegistry;
+ThreadSharedInfo * exitedThreads;
+char * threadRecordSlab;
+size_t threadRecordSlabUsed = THREAD_RECORD_SLAB_SIZE;
+
+// The background maintenance thread, see allocator::start_background_thread
+pthread_t backgroundThread;
+pthread_mutex_t backgroundLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t backgroundWakeup = PTHREAD_COND_INITIALIZER;
+bool isBackgroundRunning = false;
+unsigned int backgroundInterval;
+size_t backgroundBudget;
+
+__thread MemoryBlock * bins[NUM_OF_THREAD_BINS];
+__thread ThreadSharedInfo * currentThreadInfo;
+__thread uint32_t nextRegionSize = INITIAL_REGION_SIZE;
+__thread size_t cachedBytes; // total size of the free blocks in the thread's bins
+__thread uint32_t mallocsInEpoch; // calls the thread has made to malloc this epoch
+__thread uint32_t cacheMissesInEpoch; // times the thread took memory from the span pool or the heap this epoch
+volatile size_t threadCacheGrowth; // total growth of the cache limits of all threads above THREAD_CACHE_MINIMUM
+__thread RemoteFreeBatch remoteFreeBatches[REMOTE_FREE_SLOTS];
+__thread uint32_t remoteFreeEpoch; // maintenanceEpoch when the thread last handed its batches over
+volatile uint32_t maintenanceEpoch; // passes the background thread has started
+#ifdef RECENT_FIRST_BINS
+__thread MemoryBlock * recentlyBinnedBlock; // the block the thread binned last, for as long as it stays binned
+#endif
+#ifdef ADDRESS_ORDERED_BINS
+__thread MemoryBlock * lastOrderedBlock; // the block the thread inserted last, for as long as it stays binned
+#endif
+#ifdef LIFETIME_HEAPS
+// The counts that the current thread keeps for an allocation site, see LIFETIME_HEAPS
+struct AllocationSite {
+  uint32_t allocations; // blocks allocated at the site, halved every ALLOCATION_SITE_WINDOW calls to malloc
+  int32_t live; // blocks allocated at the site that the thread has not seen freed yet
+};
 
-__thread MemoryBlock * bins[NUM_OF_BINS];
-__thread ThreadSharedInfo currentThreadInfo;
-__thread bool isInitialized = false;
+__thread AllocationSite allocationSites[ALLOCATION_SITES];
+__thread uint32_t siteWindowMallocs; // calls to malloc that allocationSites count, halved with them
+__thread size_t allocationSiteOverride; // see allocator::set_allocation_site
+#endif
+uint32_t nextRegionColor;
 
 // Macro to acquire the global lock
-#define GLOBAL_LOCK pthread_mutex_lock(&globalLock)
+#define GLOBAL_LOCK adaptiveLock(&globalLock)
 
 // Macro to release the global lock
-#define GLOBAL_UNLOCK pthread_mutex_unlock(&globalLock)
+#define GLOBAL_UNLOCK adaptiveUnlock(&globalLock)
 
 const uint64_t deBruijn = 0x022fdd63cc95386d;
 const unsigned int convert[64] = {
@@ -133,7 +357,7 @@ int lgFloor(uint32_t n) {
 int allocator::check() {
   // Check that bins contain only free blocks
   MemoryBlock * locMB;
-  for (int i = 0; i < NUM_OF_BINS; i++) {
+  for (int i = 0; i < NUM_OF_THREAD_BINS; i++) {
     locMB = bins[i];
     while (locMB) {
       if (!(locMB->isFree)) {
@@ -145,7 +369,7 @@ int allocator::check() {
   }
 
   // Check that memory blocks in bins have correctly set previous and next pointers
-  for (int i = 0; i < NUM_OF_BINS; i++) {
+  for (int i = 0; i < NUM_OF_THREAD_BINS; i++) {
     locMB = bins[i];
     if (locMB && locMB->previousFreeBlock != 0) {
       printf("Bin %d points to a block whose previousFreeBlock is not 0\n", i);
@@ -160,7 +384,7 @@ int allocator::check() {
     }
   }
 
-  locMB = currentThreadInfo.unbinnedBlocks;
+  locMB = currentThreadInfo ? currentThreadInfo->unbinnedBlocks : 0;
   if (locMB && locMB->previousFreeBlock != 0) {
     printf("unbinnedBlocks points to a block whose previousFreeBlock is not 0\n");
     return -1;
@@ -176,12 +400,12 @@ int allocator::check() {
   // Check that bins do not contain any duplicate blocks. This test is extremely slow. Use with caution.
   /*
   MemoryBlock * locMB2;
-  for (int i = 0; i < NUM_OF_BINS; i++) {
+  for (int i = 0; i < NUM_OF_THREAD_BINS; i++) {
     locMB = bins[i];
     while (locMB) {
       locMB2 = locMB->nextFreeBlock;
       int j = i;
-      while (j < NUM_OF_BINS) {
+      while (j < NUM_OF_THREAD_BINS) {
         while (locMB2) {
           if (locMB == locMB2) {
             printf("Bin %d contains a memory block that is also present in bin %d\n", i, j);
@@ -190,15 +414,17 @@ int allocator::check() {
           locMB2 = locMB2->nextFreeBlock;
         }
         j++;
-        locMB2 = (j < NUM_OF_BINS) ? bins[j] : 0;
+        locMB2 = (j < NUM_OF_THREAD_BINS) ? bins[j] : 0;
       }
       locMB = locMB->nextFreeBlock;
     }
   }
   */
 
-  // Check that all memory blocks in managed space have correctly set footers and threadInfo
+  // Check that all memory blocks in managed space have correctly set footers, and that the page map agrees with
+  // their threadInfo
   MemoryBlockFooter * footer;
+  uintptr_t pageSize = (uintptr_t) 1 << PAGE_MAP_PAGE_SHIFT;
   for (locMB = (MemoryBlock *) memoryStart; locMB && locMB !=endOfHeap; locMB = (MemoryBlock *) ((char *) locMB + locMB->size))
   {
     footer = MB_ADDRESS_TO_OWN_FOOTER_ADDRESS(locMB);
@@ -206,45 +432,164 @@ int allocator::check() {
       printf("Memory space contains a block at %p that does not have a correctly assigned footer\n", locMB);
       return -1;
     }
+    uintptr_t page = ((uintptr_t) locMB + pageSize - 1) & ~(pageSize - 1);
+    for (; page < (uintptr_t) locMB + locMB->size; page += pageSize) {
+      if (pageMapGet(&pageMap, (void *) page) != locMB->threadInfo) {
+        printf("The page map does not record the owner of the block at %p for page %p\n", locMB, (void *) page);
+        return -1;
+      }
+    }
   }
+
+#ifdef SPAN_DESCRIPTORS
+  // Check that the descriptors of the span pools agree with the headers of the spans they describe
+  for (int node = 0; node < numaNodes; node++) {
+    SpanPool * pool = &spanPools[node];
+    for (size_t i = 0; i < pool->numSpans; i++) {
+      locMB = pool->spans[i].span;
+      if (locMB->spanIndex != i || locMB->threadInfo != (void *) pool || !locMB->isFree ||
+          locMB->size != pool->spans[i].size) {
+        printf("Span pool %d has a descriptor that does not match the span at %p\n", node, locMB);
+        return -1;
+      }
+    }
+  }
+#endif
   return 0;
 }
 
 // init - Initialize the malloc package.  Called once before any other
 // calls are made.  Since this is a very simple implementation, we just
 // return success.
+// A background thread that is running would take the locks of the span pools while they are set up again, so it is
+// stopped first, and started again with the same settings once the heap is set up.
 int allocator::init() {
-  pthread_mutexattr_init(&globalLockAttr);
-  pthread_mutexattr_settype(&globalLockAttr, PTHREAD_MUTEX_RECURSIVE);
-  pthread_mutex_init(&globalLock, &globalLockAttr);
+  pthread_mutex_lock(&backgroundLock);
+  bool wasBackgroundRunning = isBackgroundRunning;
+  unsigned int interval = backgroundInterval;
+  size_t budget = backgroundBudget;
+  pthread_mutex_unlock(&backgroundLock);
+  stop_background_thread();
+  canSpinOnLocks = HL::CPUInfo::getNumProcessors() > 1;
+  adaptiveLockInit(&globalLock, canSpinOnLocks);
   GLOBAL_LOCK;
+  // The heap must be empty, so that memlib's brk is where the heap ends
   endOfHeap = mem_heap_lo();
   memoryStart = endOfHeap;
-  isInitialized = false;
+  heapTailOwner = 0;
+  currentThreadInfo = 0;
+  threadCacheGrowth = 0;
+  for (int i = 0; i < REMOTE_FREE_SLOTS; i++) {
+    remoteFreeBatches[i].owner = 0;
+    remoteFreeBatches[i].count = 0;
+  }
+  // Records of the threads that used the previous heap start over, all of them waiting to be taken over
+  exitedThreads = 0;
+  for (ThreadSharedInfo * record = threadRegistry; record; record = record->nextThread) {
+    record->unbinnedBlocks = 0;
+    record->cacheLimit = THREAD_CACHE_MINIMUM;
+    record->hasExited = true;
+    record->nextExitedThread = exitedThreads;
+    exitedThreads = record;
+  }
+  int nodes = (mem_numa_nodes() < MAXIMUM_NUMA_NODES) ? mem_numa_nodes() : MAXIMUM_NUMA_NODES;
+  numaNodes = nodes;
   GLOBAL_UNLOCK;
+  for (int node = 0; node < nodes; node++) {
+    adaptiveLockInit(&(spanPools[node].lock), canSpinOnLocks);
+    spanPools[node].freeBytes = 0;
+#ifdef SPAN_DESCRIPTORS
+    spanPools[node].numSpans = 0;
+#else
+    for (int i = 0; i < NUM_OF_BINS; i++) {
+      spanPools[node].bins[i] = 0;
+    }
+#endif
+  }
+  pthread_once(&threadExitKeyOnce, createThreadExitKey);
+#ifdef PER_CPU_CACHES
+  // Blocks cached from a previous heap must not outlive it
+  long numCpus = sysconf(_SC_NPROCESSORS_CONF);
+  for (long cpu = 0; cpu < numCpus && cpu < PERCPU_MAXIMUM_CPUS; cpu++) {
+    std::memset(perCpuCaches[cpu].counts, 0, sizeof(perCpuCaches[cpu].counts));
+  }
+  perCpuCachesEnabled = percpuAvailable();
+#endif
+  if (wasBackgroundRunning && start_background_thread(interval, budget)) {
+    return -1;
+  }
   return 0;
 }
 
 // Helper method that calculates what bin a memory block should be assigned to as a function of its size
 static inline int getBinIndex(uint32_t size) {
   assert (size > 0);
-  if (size < BIN_INDEX_THRESHOLD) {
-    return size / 8;
+  if (size < SIZE_CLASS_LIMIT) {
+    return sizeClassTable[size / SIZE_CLASS_GRANULE];
   }
-  int returnIndex = lgFloor(size) + 118;
-  assert(floor(log2(size)) + 118 == returnIndex);
+  int returnIndex = lgFloor(size) - SIZE_CLASS_LIMIT_SHIFT + SIZE_CLASS_COUNT;
+  assert(floor(log2(size)) - SIZE_CLASS_LIMIT_SHIFT + SIZE_CLASS_COUNT == returnIndex);
   return ((returnIndex >= NUM_OF_BINS) ? (NUM_OF_BINS - 1) : returnIndex);
 }
 
+// Helper method that calculates which of the current thread's bins a free memory block should be assigned to. With
+// LIFETIME_HEAPS, the bins of the long-lived heap follow those of the short-lived one.
+static inline int getThreadBinIndex(MemoryBlock * mb) {
+#ifdef LIFETIME_HEAPS
+  return getBinIndex(mb->size) + (mb->isLongLived ? NUM_OF_BINS : 0);
+#else
+  return getBinIndex(mb->size);
+#endif
+}
+
+#ifdef LIFETIME_HEAPS
+// Helper method that returns the allocation site of a call to malloc with the given return address
+static inline int getAllocationSite(void * returnAddress) {
+  size_t address = allocationSiteOverride ? allocationSiteOverride : (size_t) returnAddress;
+  return 1 + (int) ((((uint64_t) address * 0x9e3779b97f4a7c15ull) >> 32) % (ALLOCATION_SITES - 1));
+}
+
+// Helper method that counts a block allocated at the given site as live, and predicts whether it will be long-lived
+static inline bool countSiteAllocation(int site) {
+  AllocationSite * counts = &allocationSites[site];
+  counts->allocations++;
+  counts->live++;
+  if (++siteWindowMallocs == ALLOCATION_SITE_WINDOW) {
+    for (int i = 0; i < ALLOCATION_SITES; i++) {
+      allocationSites[i].allocations /= 2;
+    }
+    siteWindowMallocs /= 2;
+  }
+  return counts->allocations >= ALLOCATION_SITE_SAMPLES && counts->live > 0 &&
+         (uint64_t) counts->live * siteWindowMallocs >= (uint64_t) LONG_LIVED_LIFETIME * counts->allocations;
+}
+
+// Helper method that counts an allocated block of the current thread as no longer live at its site
+static inline void countSiteFree(MemoryBlock * mb) {
+  if (mb->site) {
+    allocationSites[mb->site].live--;
+    mb->site = 0;
+  }
+}
+#endif
+
+#ifdef PER_CPU_CACHES
+// Helper method that calculates what per-CPU cache class holds blocks of the given size
+static inline long getPerCpuClass(uint32_t size) {
+  assert(size >= MINIMUM_ALLOCATED_BLOCK_SIZE && size <= PER_CPU_MAXIMUM_BLOCK_SIZE && size % ALIGNMENT == 0);
+  return (size - MINIMUM_ALLOCATED_BLOCK_SIZE) / ALIGNMENT;
+}
+#endif
+
 // Helper method that prints all free blocks present in bins (used for debugging)
 static inline void printStateOfBins() {
   std::cout<<"\nUnbinned: ";
-  MemoryBlock * locMB = currentThreadInfo.unbinnedBlocks;
+  MemoryBlock * locMB = currentThreadInfo->unbinnedBlocks;
   while (locMB) {
     std::cout<<"{"<<locMB->size<<"}";
     locMB = locMB->nextFreeBlock;
   }
-  for (int i = 0; i < NUM_OF_BINS; i++) {
+  for (int i = 0; i < NUM_OF_THREAD_BINS; i++) {
     locMB = bins[i];
     if (!locMB) {
       continue;
@@ -275,28 +620,75 @@ static inline void printStateOfMemory() {
   }
 }
 
-// Helper method that assigns a freed memory block to a bin
+// Helper method that pushes a free memory block onto the front of a binned list, unbinned list or span pool bin
+static inline void addBlockToLinkedList(MemoryBlock * mb, MemoryBlock * &listHead) {
+  assert (mb != 0);
+  mb->nextFreeBlock = listHead;
+  if (listHead) {
+    assert (listHead->previousFreeBlock == 0);
+    listHead->previousFreeBlock = mb;
+  }
+  mb->previousFreeBlock = 0;
+  listHead = mb;
+}
+
+#ifdef ADDRESS_ORDERED_BINS
+// Helper method that inserts a free memory block into a binned list that is kept in increasing address order,
+// searching from previous, a block of the list below mb, if it is not null
+static inline void addBlockToAddressOrderedList(MemoryBlock * mb, MemoryBlock * &listHead, MemoryBlock * previous) {
+  assert (mb != 0);
+  assert (previous == 0 || previous < mb);
+  MemoryBlock * next = previous ? previous->nextFreeBlock : listHead;
+  while (next && next < mb) {
+    previous = next;
+    next = next->nextFreeBlock;
+  }
+  mb->nextFreeBlock = next;
+  mb->previousFreeBlock = previous;
+  if (next) {
+    next->previousFreeBlock = mb;
+  }
+  if (previous) {
+    previous->nextFreeBlock = mb;
+  } else {
+    listHead = mb;
+  }
+}
+#endif
+
+// Helper method that assigns a freed memory block to a bin. Bins are LIFO, so that the block freed last is reused
+// first while it is still in cache; with ADDRESS_ORDERED_BINS they are kept in address order instead, so that
+// blocks allocated one after another from the same bin end up next to each other. Blocks are mostly freed in
+// the order they were allocated, so the search for the insertion point starts at the block inserted last.
 static inline void assignBlockToBinnedList(MemoryBlock * mb) {
   assert (mb != 0);
   assert (mb->isFree);
-  int index = getBinIndex(mb->size);
-  mb->nextFreeBlock = bins[index];
-  if (bins[index]) {
-    assert (bins[index]->previousFreeBlock == 0);
-    bins[index]->previousFreeBlock = mb;
+#ifdef ADDRESS_ORDERED_BINS
+  int bin = getThreadBinIndex(mb);
+  MemoryBlock * previous = lastOrderedBlock;
+  if (previous && (previous > mb || getThreadBinIndex(previous) != bin)) {
+    previous = 0;
   }
-  mb->previousFreeBlock = 0;
-  bins[index] = mb;
+  addBlockToAddressOrderedList(mb, bins[bin], previous);
+  lastOrderedBlock = mb;
+#else
+  addBlockToLinkedList(mb, bins[getThreadBinIndex(mb)]);
+#endif
+#ifdef RECENT_FIRST_BINS
+  recentlyBinnedBlock = mb;
+#endif
+  cachedBytes += mb->size;
 }
 
 // Helper method that assigns a freed memory block to the unbinned list of the thread the block belongs to, 
-// used when a block is freed on a different thread than the one it was assigned on
+// used when a block is freed on a different thread than the one it was assigned on. The block stays marked as
+// allocated until its owner bins it, so that the owner never coalesces it in the meantime.
 static inline void assignBlockToThreadSpecificUnbinnedList(MemoryBlock * mb) {
   assert(mb);
-  assert(mb->isFree);
+  assert(!mb->isFree);
   assert(mb->threadInfo);
   ThreadSharedInfo * mbThreadInfo = (ThreadSharedInfo *) mb->threadInfo;
-  pthread_mutex_lock(&(mbThreadInfo->localLock));
+  adaptiveLock(&(mbThreadInfo->localLock));
   mb->nextFreeBlock = mbThreadInfo->unbinnedBlocks;
   if (mbThreadInfo->unbinnedBlocks) {
     assert(mbThreadInfo->unbinnedBlocks->previousFreeBlock == 0);
@@ -304,7 +696,82 @@ static inline void assignBlockToThreadSpecificUnbinnedList(MemoryBlock * mb) {
   }
   mb->previousFreeBlock = 0;
   mbThreadInfo->unbinnedBlocks = mb;
-  pthread_mutex_unlock(&(mbThreadInfo->localLock));
+  adaptiveUnlock(&(mbThreadInfo->localLock));
+}
+
+// Helper method that hands a batch of blocks over to the unbinned list of their owner, under a single acquisition
+// of the owner's local lock, and leaves the batch empty
+static inline void flushRemoteFreeBatch(RemoteFreeBatch * batch) {
+  if (!batch->count) {
+    return;
+  }
+  ThreadSharedInfo * owner = batch->owner;
+  adaptiveLock(&(owner->localLock));
+  batch->tail->nextFreeBlock = owner->unbinnedBlocks;
+  if (owner->unbinnedBlocks) {
+    assert(owner->unbinnedBlocks->previousFreeBlock == 0);
+    owner->unbinnedBlocks->previousFreeBlock = batch->tail;
+  }
+  owner->unbinnedBlocks = batch->head;
+  adaptiveUnlock(&(owner->localLock));
+  batch->head = 0;
+  batch->tail = 0;
+  batch->count = 0;
+}
+
+// Helper method that hands every batch of the current thread over to the blocks' owners
+static inline void flushRemoteFreeBatches() {
+  for (int i = 0; i < REMOTE_FREE_SLOTS; i++) {
+    flushRemoteFreeBatch(&remoteFreeBatches[i]);
+  }
+}
+
+// Helper method that hands every batch of the current thread over if the background thread has started a pass since
+// they were last handed over, so that blocks in batches that are not full yet do not wait for the thread to exit
+static inline void flushStaleRemoteFreeBatches() {
+  uint32_t epoch = maintenanceEpoch;
+  if (remoteFreeEpoch != epoch) {
+    remoteFreeEpoch = epoch;
+    flushRemoteFreeBatches();
+  }
+}
+
+// Helper method that adds a block freed on a different thread than the one it was assigned on to the current
+// thread's batch for the block's owner, handing the batch over once it is full
+static inline void addBlockToRemoteFreeBatch(MemoryBlock * mb) {
+  assert(!mb->isFree);
+  // A thread that has never allocated has no record, but still hands its batches over when it exits
+  if (!currentThreadInfo && !pthread_getspecific(threadExitKey)) {
+    pthread_setspecific(threadExitKey, (void *) remoteFreeBatches);
+  }
+  ThreadSharedInfo * owner = (ThreadSharedInfo *) mb->threadInfo;
+  RemoteFreeBatch * batch = &remoteFreeBatches[((uintptr_t) owner / CACHE_LINE_SIZE) % REMOTE_FREE_SLOTS];
+  if (batch->owner != owner) {
+    flushRemoteFreeBatch(batch);
+    batch->owner = owner;
+  }
+  mb->nextFreeBlock = batch->head;
+  mb->previousFreeBlock = 0;
+  if (batch->head) {
+    batch->head->previousFreeBlock = mb;
+  } else {
+    batch->tail = mb;
+  }
+  batch->head = mb;
+  if (++(batch->count) == REMOTE_FREE_BATCH) {
+    flushRemoteFreeBatch(batch);
+  }
+}
+
+// Helper method that hands a freed memory block to a bin of the current thread if it owns the block, and to the
+// owner's unbinned list otherwise
+static inline void assignBlockToOwner(MemoryBlock * mb) {
+  if (mb->threadInfo == currentThreadInfo) {
+    mb->isFree = true;
+    assignBlockToBinnedList(mb);
+  } else {
+    assignBlockToThreadSpecificUnbinnedList(mb);
+  }
 }
 
 // Helper method that removes a free memory block from a given binned list or unbinned list, used to unlink blocks
@@ -321,6 +788,38 @@ static inline void removeBlockFromLinkedList (MemoryBlock * mb, MemoryBlock * &l
   }
 }
 
+// Helper method that removes a free memory block from the bin of the current thread that holds it
+static inline void removeBlockFromBinnedList(MemoryBlock * mb) {
+  removeBlockFromLinkedList(mb, bins[getThreadBinIndex(mb)]);
+#ifdef RECENT_FIRST_BINS
+  if (mb == recentlyBinnedBlock) {
+    recentlyBinnedBlock = 0;
+  }
+#endif
+#ifdef ADDRESS_ORDERED_BINS
+  if (mb == lastOrderedBlock) {
+    lastOrderedBlock = 0;
+  }
+#endif
+  cachedBytes -= mb->size;
+}
+
+// Helper method that returns whether a neighbouring block is free and owned by the given owner. isFree is read
+// first: donateSpan hands a span to its pool before marking it free, so a block seen free already shows its owner.
+static inline bool isFreeBlockOwnedBy(MemoryBlock * mb, void * owner) {
+  return __atomic_load_n(&(mb->isFree), __ATOMIC_ACQUIRE) && mb->threadInfo == owner;
+}
+
+// Helper method that returns whether a neighbouring free block of the current thread may coalesce with mb: with
+// LIFETIME_HEAPS, only blocks of the same heap do
+static inline bool canCoalesceWith(MemoryBlock * neighbour, MemoryBlock * mb) {
+#ifdef LIFETIME_HEAPS
+  return neighbour->isLongLived == mb->isLongLived;
+#else
+  return true;
+#endif
+}
+
 // Helper method that sets a block's footer by assigning it the block's size
 static inline void assignBlockFooter (MemoryBlock * mb) {
   MemoryBlockFooter * footer = MB_ADDRESS_TO_OWN_FOOTER_ADDRESS(mb);
@@ -334,225 +833,1153 @@ static inline void truncateMemoryBlock (MemoryBlock * mb, size_t new_size) {
     assert(mb->threadInfo);
     MemoryBlock * nextBlock = (MemoryBlock *)((char *)mb + new_size);
     nextBlock->size = mb->size - new_size;
-    nextBlock->isFree = true;
+    nextBlock->isFree = false;
     nextBlock->threadInfo = mb->threadInfo;
+#ifdef LIFETIME_HEAPS
+    nextBlock->isLongLived = mb->isLongLived;
+    nextBlock->site = 0;
+#endif
     assignBlockFooter(nextBlock);
-    if (nextBlock->threadInfo == &currentThreadInfo) {
-      assignBlockToBinnedList(nextBlock);
-    } else {
-      assignBlockToThreadSpecificUnbinnedList(nextBlock);
+    assignBlockToOwner(nextBlock);
+    mb->size = new_size;
+    assignBlockFooter(mb);
+  }
+}
+
+// Helper method that calculates how far past the given address a region or span taken there must start, so that it
+// starts on a cache line of its own with the next color. Whatever is skipped must be big enough to stand as a block.
+static inline size_t getRegionPadding(uintptr_t start) {
+  size_t padding = (CACHE_LINE_SIZE - start % CACHE_LINE_SIZE) % CACHE_LINE_SIZE;
+  if (padding && padding < MINIMUM_ALLOCATED_BLOCK_SIZE) {
+    padding += CACHE_LINE_SIZE;
+  }
+  return padding + (__sync_fetch_and_add(&nextRegionColor, 1) % REGION_COLORS) * CACHE_LINE_SIZE;
+}
+
+#ifdef SPAN_DESCRIPTORS
+// Helper method that adds a free span to a span pool, doubling the pool's array of descriptors if it is full.
+// Returns false if the array cannot grow.
+static inline bool addSpanToPool(SpanPool * pool, MemoryBlock * mb, bool isPurged) {
+  if (pool->numSpans == pool->spanCapacity) {
+    size_t capacity = pool->spanCapacity ? 2 * pool->spanCapacity : SPAN_DESCRIPTORS_INITIAL_CAPACITY;
+    void * spans = mmap(NULL, capacity * sizeof(SpanDescriptor), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (spans == MAP_FAILED) {
+      return false;
+    }
+    if (pool->spans) {
+      std::memcpy(spans, pool->spans, pool->numSpans * sizeof(SpanDescriptor));
+      munmap(pool->spans, pool->spanCapacity * sizeof(SpanDescriptor));
+    }
+    pool->spans = (SpanDescriptor *) spans;
+    pool->spanCapacity = capacity;
+  }
+  SpanDescriptor * descriptor = &(pool->spans[pool->numSpans]);
+  descriptor->span = mb;
+  descriptor->size = mb->size;
+  descriptor->isPurged = isPurged;
+  mb->spanIndex = pool->numSpans++;
+  return true;
+}
+
+// Helper method that removes a free span from its span pool, moving the last descriptor into its place, and
+// returns whether the pages inside the span had been purged
+static inline bool removeSpanFromPool(SpanPool * pool, MemoryBlock * mb) {
+  size_t index = mb->spanIndex;
+  assert(index < pool->numSpans && pool->spans[index].span == mb);
+  bool isPurged = pool->spans[index].isPurged;
+  pool->numSpans--;
+  if (index != pool->numSpans) {
+    pool->spans[index] = pool->spans[pool->numSpans];
+    pool->spans[index].span->spanIndex = index;
+  }
+  return isPurged;
+}
+
+// Helper method that returns the smallest span in a span pool that is at least size big, or NULL if there is none
+static inline MemoryBlock * findSpanInPool(SpanPool * pool, size_t size) {
+  SpanDescriptor * best = 0;
+  for (SpanDescriptor * descriptor = pool->spans; descriptor < pool->spans + pool->numSpans; descriptor++) {
+    if (descriptor->size >= size && (!best || descriptor->size < best->size)) {
+      best = descriptor;
+      if (best->size == size) {
+        break;
+      }
+    }
+  }
+  return best ? best->span : NULL;
+}
+#else
+// Helper method that adds a free span to the bin of a span pool that fits its size. Always returns true.
+static inline bool addSpanToPool(SpanPool * pool, MemoryBlock * mb, bool isPurged) {
+  mb->isPurged = isPurged;
+  addBlockToLinkedList(mb, pool->bins[getBinIndex(mb->size)]);
+  return true;
+}
+
+// Helper method that removes a free span from its span pool, and returns whether the pages inside the span had
+// been purged
+static inline bool removeSpanFromPool(SpanPool * pool, MemoryBlock * mb) {
+  removeBlockFromLinkedList(mb, pool->bins[getBinIndex(mb->size)]);
+  return mb->isPurged;
+}
+
+// Helper method that returns the first span in the bins of a span pool, starting with the bin of the given size,
+// that is at least size big, or NULL if there is none
+static inline MemoryBlock * findSpanInPool(SpanPool * pool, size_t size) {
+  for (int i = getBinIndex(size); i < NUM_OF_BINS; i++) {
+    for (MemoryBlock * span = pool->bins[i]; span; span = span->nextFreeBlock) {
+      if (span->size >= size) {
+        return span;
+      }
+    }
+  }
+  return NULL;
+}
+#endif
+
+// Helper method that hands a free span over to the span pool of its owner's NUMA node, coalescing it with that
+// pool's spans on either side. If the pool has no room to describe the span, the span stays allocated to the pool
+// and is never reused.
+static inline void donateSpan(MemoryBlock * mb) {
+  SpanPool * pool = &spanPools[((ThreadSharedInfo *) mb->threadInfo)->node];
+  adaptiveLock(&(pool->lock));
+  mb->threadInfo = (void *) pool;
+  pageMapSetRange(&pageMap, mb, mb->size, (void *) pool);
+  __sync_synchronize(); // The previous owner must never see the span free while it still has its threadInfo
+  mb->isFree = true;
+  pool->freeBytes += mb->size;
+
+  MemoryBlock * nextMB = (MemoryBlock *) ((char *) mb + mb->size);
+  while (nextMB != endOfHeap && nextMB->threadInfo == (void *) pool && nextMB->isFree &&
+         mb->size + nextMB->size <= MAXIMUM_COALESCED_SIZE) {
+    removeSpanFromPool(pool, nextMB);
+    mb->size += nextMB->size;
+    nextMB = (MemoryBlock *) ((char *) mb + mb->size);
+  }
+  while ((void *) mb > memoryStart) {
+    MemoryBlock * prevMB = (MemoryBlock *) ((char *) mb - *MB_ADDRESS_TO_PREVIOUS_FOOTER_ADDRESS(mb));
+    if (prevMB->threadInfo != (void *) pool || !prevMB->isFree || prevMB->size + mb->size > MAXIMUM_COALESCED_SIZE) {
+      break;
     }
+    removeSpanFromPool(pool, prevMB);
+    prevMB->size += mb->size;
+    mb = prevMB;
+  }
+  assignBlockFooter(mb);
+  if (!addSpanToPool(pool, mb, false)) {
+    mb->isFree = false;
+    pool->freeBytes -= mb->size;
+  }
+  adaptiveUnlock(&(pool->lock));
+}
+
+// Helper method that truncates a large block to new_size, a whole number of pages, and hands the pages it no longer
+// needs over to the span pool, like free does with a large block
+static inline void truncateLargeBlock(MemoryBlock * mb, size_t new_size) {
+  if (mb->size >= new_size + LARGE_BLOCK_UNIT) {
+    MemoryBlock * nextBlock = (MemoryBlock *) ((char *) mb + new_size);
+    nextBlock->size = mb->size - new_size;
+    nextBlock->isFree = false;
+    nextBlock->threadInfo = mb->threadInfo;
+#ifdef LIFETIME_HEAPS
+    nextBlock->isLongLived = false;
+    nextBlock->site = 0;
+#endif
+    assignBlockFooter(nextBlock);
     mb->size = new_size;
     assignBlockFooter(mb);
+    donateSpan(nextBlock);
   }
 }
 
-// Helper method that assigns all memory blocks present in the unbinned list to suitable binned lists.
-// Also coalesces contiguous free blocks.
-static inline void binAllUnbinnedBlocks() {
-  if (!currentThreadInfo.unbinnedBlocks) {
+// Helper method that takes over a span from the span pool of the current thread's NUMA node and returns it as an
+// allocated block of the given size owned by the current thread. For a small block that starts a region, only as
+// much of the span as a fresh region would hold leaves the pool; the rest of that part is binned by the thread. Any
+// other block takes just its own size, and the rest of the span stays in the pool.
+static inline MemoryBlock * takeSpan(size_t size, bool isRegion) {
+  SpanPool * pool = &spanPools[currentThreadInfo->node];
+  if (pool->freeBytes < size) {
+    return NULL;
+  }
+  adaptiveLock(&(pool->lock));
+  MemoryBlock * mb = findSpanInPool(pool, size);
+  if (!mb) {
+    adaptiveUnlock(&(pool->lock));
+    return NULL;
+  }
+  bool isPurged = removeSpanFromPool(pool, mb);
+  pool->freeBytes -= mb->size;
+  size_t padding = isRegion ? getRegionPadding((uintptr_t) mb) : 0;
+  if (padding && mb->size >= padding + size) {
+    // The skipped front part stays in the pool
+    MemoryBlock * front = mb;
+    uint32_t spanSize = front->size;
+    front->size = padding;
+    if (addSpanToPool(pool, front, isPurged)) {
+      assignBlockFooter(front);
+      pool->freeBytes += front->size;
+      mb = (MemoryBlock *) ((char *) front + padding);
+      mb->size = spanSize - padding;
+    } else {
+      front->size = spanSize;
+    }
+  }
+  size_t takenSize = isRegion ? size + nextRegionSize : size;
+  if (mb->size >= takenSize + MINIMUM_ALLOCATED_BLOCK_SIZE) {
+    MemoryBlock * rest = (MemoryBlock *) ((char *) mb + takenSize);
+    rest->size = mb->size - takenSize;
+    rest->threadInfo = (void *) pool;
+    rest->isFree = true;
+    assignBlockFooter(rest);
+    if (addSpanToPool(pool, rest, isPurged)) {
+      pool->freeBytes += rest->size;
+      mb->size = takenSize;
+    }
+  }
+  mb->threadInfo = (void *) currentThreadInfo;
+  mb->isFree = false;
+#ifdef LIFETIME_HEAPS
+  mb->isLongLived = false;
+  mb->site = 0;
+#endif
+  assignBlockFooter(mb);
+  pageMapSetRange(&pageMap, mb, mb->size, (void *) currentThreadInfo);
+  adaptiveUnlock(&(pool->lock));
+  truncateMemoryBlock(mb, size);
+  return mb;
+}
+
+// Helper method that sets the cache limit of a thread, and accounts for the change in the limits' total growth.
+// Both the thread and the background thread set it, so it is swapped atomically.
+static inline void setThreadCacheLimit(ThreadSharedInfo * record, size_t limit) {
+  size_t previous = __atomic_exchange_n(&(record->cacheLimit), limit, __ATOMIC_RELAXED);
+  __sync_fetch_and_add(&threadCacheGrowth, limit - previous);
+}
+
+// Helper method that raises the cache limit of the current thread by the given number of bytes, or by as much of
+// it as THREAD_CACHE_BUDGET leaves room for
+static inline void growThreadCacheLimit(size_t bytes) {
+  size_t growth = threadCacheGrowth;
+  if (growth >= THREAD_CACHE_BUDGET) {
     return;
   }
-  pthread_mutex_lock(&(currentThreadInfo.localLock));
-  MemoryBlock * mb = currentThreadInfo.unbinnedBlocks;
+  bytes = (bytes < THREAD_CACHE_BUDGET - growth) ? bytes : THREAD_CACHE_BUDGET - growth;
+  __sync_fetch_and_add(&(currentThreadInfo->cacheLimit), bytes);
+  __sync_fetch_and_add(&threadCacheGrowth, bytes);
+}
+
+// Helper method that hands the largest free blocks in the current thread's bins over to the span pool, until the
+// thread keeps no more than three quarters of its cache limit. The thread is taking more memory than it uses, so
+// its next region will be half as big. Kept out of line, as it is rarely called from the fast paths.
+__attribute__((noinline)) static void scavengeThreadCache() {
+  size_t target = currentThreadInfo->cacheLimit / 4 * 3;
+  for (int i = NUM_OF_THREAD_BINS - 1; i >= 0 && cachedBytes > target; i--) {
+    while (bins[i] && cachedBytes > target) {
+      MemoryBlock * mb = bins[i];
+      removeBlockFromBinnedList(mb);
+      mb->isFree = false;
+      donateSpan(mb);
+    }
+  }
+  nextRegionSize = (nextRegionSize > 2 * INITIAL_REGION_SIZE) ? nextRegionSize / 2 : INITIAL_REGION_SIZE;
+}
+
+// Helper method, called every THREAD_CACHE_EPOCH calls to malloc, that halves the current thread's cache limit if
+// the thread has not had to take memory from the span pool or the heap since the previous call, and scavenges the
+// thread's bins down to the new limit
+__attribute__((noinline)) static void endThreadCacheEpoch() {
+  if (!cacheMissesInEpoch) {
+    size_t limit = currentThreadInfo->cacheLimit / 2;
+    setThreadCacheLimit(currentThreadInfo, (limit > THREAD_CACHE_MINIMUM) ? limit : THREAD_CACHE_MINIMUM);
+    if (cachedBytes > currentThreadInfo->cacheLimit) {
+      scavengeThreadCache();
+    }
+  }
+  mallocsInEpoch = 0;
+  cacheMissesInEpoch = 0;
+}
+
+// Helper method that returns whether a block of the current thread borders a free span of its node's span pool
+static inline bool bordersFreeSpan(MemoryBlock * mb) {
+  void * pool = (void *) &spanPools[currentThreadInfo->node];
+  MemoryBlock * nextMB = (MemoryBlock *) ((char *) mb + mb->size);
+  if (nextMB != endOfHeap && isFreeBlockOwnedBy(nextMB, pool)) {
+    return true;
+  }
+  if ((void *) mb == memoryStart) {
+    return false;
+  }
+  MemoryBlock * prevMB = (MemoryBlock *) ((char *) mb - *MB_ADDRESS_TO_PREVIOUS_FOOTER_ADDRESS(mb));
+  return isFreeBlockOwnedBy(prevMB, pool);
+}
+
+// Helper method that coalesces an allocated memory block of the current thread that is being freed with the free
+// blocks around it, and assigns the result to a suitable binned list, or hands it to the span pool if it ends up
+// at least SPAN_POOL_THRESHOLD big
+static inline void coalesceAndBinBlock(MemoryBlock * mb) {
+  assert(!mb->isFree);
+  assert(mb->threadInfo == (void *) currentThreadInfo);
   MemoryBlock * nextMB, * prevMB;
   size_t totalFree;
+#ifdef LIFETIME_HEAPS
+  countSiteFree(mb);
+#endif
 
-  while (mb) {
-    assert(mb->isFree);
-    assert(mb->threadInfo == (void *) &currentThreadInfo);
-    mb->isFree = false; // Necessary as a sentinal for coalescing so blocks from the unbinned list don't coalesce with one another
-    mb = mb->nextFreeBlock;
+  // Coalesce with free blocks on the right
+  nextMB = (MemoryBlock *) ((char *) mb + mb->size);
+  totalFree = 0;
+  while(nextMB != endOfHeap && isFreeBlockOwnedBy(nextMB, mb->threadInfo) && canCoalesceWith(nextMB, mb) &&
+        mb->size + totalFree + nextMB->size <= MAXIMUM_COALESCED_SIZE) {
+    totalFree += nextMB->size;
+    removeBlockFromBinnedList(nextMB);
+    nextMB = (MemoryBlock *) ((char *) nextMB + nextMB->size);
   }
+  mb->size += totalFree;
+  assignBlockFooter(mb);
 
-  mb = currentThreadInfo.unbinnedBlocks;
-  while (mb) {
-    // Coalesce with free blocks on the right
-    nextMB = (MemoryBlock *) ((char *) mb + mb->size);
-    totalFree = 0;
-    while(nextMB != endOfHeap && nextMB->threadInfo == mb->threadInfo && nextMB->isFree) {
-      totalFree += nextMB->size;
-      removeBlockFromLinkedList(nextMB, bins[getBinIndex(nextMB->size)]);
-      nextMB = (MemoryBlock *) ((char *) nextMB + nextMB->size);
+  // Coalesce with free blocks on the left
+  if ((void *) mb > memoryStart) {
+    assert((void *) mb >= (void *)((char *) memoryStart + ALLOCATED_BLOCK_OVERHEAD));
+    MemoryBlockFooter * footer = MB_ADDRESS_TO_PREVIOUS_FOOTER_ADDRESS(mb);
+    prevMB = (MemoryBlock *) ((char *) mb - *footer);
+    totalFree = mb->size;
+    while ((void *) prevMB >= memoryStart && isFreeBlockOwnedBy(prevMB, mb->threadInfo) && canCoalesceWith(prevMB, mb) &&
+           totalFree + prevMB->size <= MAXIMUM_COALESCED_SIZE) {
+      totalFree += prevMB->size;
+      removeBlockFromBinnedList(prevMB);
+      mb = prevMB;
+      if ((void *) prevMB == memoryStart) {
+        break;
+      }
+      footer = MB_ADDRESS_TO_PREVIOUS_FOOTER_ADDRESS(prevMB);
+      prevMB = (MemoryBlock *) ((char *) prevMB - *footer);
     }
-    mb->size += totalFree;
+    mb->size = totalFree;
     assignBlockFooter(mb);
-    nextMB = mb->nextFreeBlock;
-
-    // Coalesce with free blocks on the left
-    if ((void *) mb > memoryStart) {
-      assert((void *) mb >= (void *)((char *) memoryStart + ALLOCATED_BLOCK_OVERHEAD));
-      MemoryBlockFooter * footer = MB_ADDRESS_TO_PREVIOUS_FOOTER_ADDRESS(mb);
-      prevMB = (MemoryBlock *) ((char *) mb - *footer);
-      totalFree = mb->size;
-      while ((void *) prevMB >= memoryStart && prevMB->threadInfo == mb->threadInfo && prevMB->isFree) {
-        totalFree += prevMB->size;
-        removeBlockFromLinkedList(prevMB, bins[getBinIndex(prevMB->size)]);
-        mb = prevMB;
-        if ((void *) prevMB == memoryStart) {
-          break;
-        }
-        footer = MB_ADDRESS_TO_PREVIOUS_FOOTER_ADDRESS(prevMB);
-        prevMB = (MemoryBlock *) ((char *) prevMB - *footer);
+  }
+
+  // Assign to a suitable bin, or to the span pool
+  if (mb->size >= SPAN_POOL_THRESHOLD || bordersFreeSpan(mb)) {
+    mb->isFree = false;
+    donateSpan(mb);
+  } else {
+    mb->isFree = true;
+    assignBlockToBinnedList(mb);
+  }
+}
+
+// Helper method that assigns up to budget memory blocks from the front of the unbinned list to suitable binned
+// lists; the rest wait for later calls. Also coalesces contiguous free blocks, and hands the spans that end up at
+// least SPAN_POOL_THRESHOLD big to the span pool. The local lock is only held to detach the blocks.
+static inline void binUnbinnedBlocks(size_t budget) {
+  if (!currentThreadInfo->unbinnedBlocks) {
+    return;
+  }
+  adaptiveLock(&(currentThreadInfo->localLock));
+  MemoryBlock * mb = currentThreadInfo->unbinnedBlocks;
+  if (!mb) {
+    // The background thread reclaimed them in the meantime
+    adaptiveUnlock(&(currentThreadInfo->localLock));
+    return;
+  }
+  MemoryBlock * lastMB = mb;
+  for (size_t n = 1; n < budget && lastMB->nextFreeBlock; n++) {
+    lastMB = lastMB->nextFreeBlock;
+  }
+  currentThreadInfo->unbinnedBlocks = lastMB->nextFreeBlock;
+  if (currentThreadInfo->unbinnedBlocks) {
+    currentThreadInfo->unbinnedBlocks->previousFreeBlock = 0;
+  }
+  lastMB->nextFreeBlock = 0;
+  adaptiveUnlock(&(currentThreadInfo->localLock));
+
+  // Blocks waiting in the unbinned list are still marked as allocated, so none of them is coalesced before it
+  // has been binned itself
+  while (mb) {
+    MemoryBlock * nextUnbinnedMB = mb->nextFreeBlock;
+    coalesceAndBinBlock(mb);
+    mb = nextUnbinnedMB;
+  }
+}
+
+// Helper method that waits for the thread that reserved the end of the heap to publish it
+static inline void waitForHeapEnd(int attempt) {
+  if (canSpinOnLocks && attempt < HEAP_RESERVATION_SPINS) {
+    adaptiveLockPause(ADAPTIVE_LOCK_MAXIMUM_BACKOFF);
+  } else {
+    sched_yield();
+  }
+}
+
+// Helper method that waits until the published end of the heap reaches end, where the caller's reservation starts
+static inline void waitForHeapEndAt(char * end) {
+  for (int attempt = 0; (char *) endOfHeap != end; attempt++) {
+    waitForHeapEnd(attempt);
+  }
+}
+
+// Helper method that takes fresh memory from the end of the heap and returns it as an allocated block of the
+// given size owned by the current thread. As long as no other thread's block ends the heap, or the block is large,
+// the heap grows by exactly that size. Otherwise the thread takes a whole region of its own, so that its blocks stay
+// contiguous and can coalesce; the rest of the region is binned as a single free block, and the next region will be
+// twice as big.
+// The region is preceded by a padding block that stays allocated, so that it starts on a cache line of its own.
+// On a NUMA machine, the new pages are bound to the thread's node before they are first touched.
+// The memory is reserved by moving memlib's brk on from the published end of the heap with a compare-and-swap, so
+// no lock is taken. Once the top of the heap has been trimmed, the brk may come back to an end of the heap that a
+// slower thread read before, so reservations wait for the ones below them and are published in order.
+static inline MemoryBlock * growHeap(size_t size) {
+  size_t growth;
+  size_t padding;
+  bool isNewRegion;
+  char * end;
+  for (int attempt = 0; ; attempt++) {
+    end = (char *) endOfHeap;
+    growth = size;
+    padding = 0;
+    isNewRegion = size < LARGE_BLOCK_THRESHOLD && heapTailOwner && heapTailOwner != (void *) currentThreadInfo;
+    if (isNewRegion) {
+      padding = getRegionPadding((uintptr_t) end);
+      growth = padding + size + nextRegionSize;
+      // End the region on a huge page boundary, or on a page boundary on a NUMA machine, so that the region after
+      // it starts on a page of its own
+      uintptr_t pageSize = mem_hugepages() ? mem_hugepagesize() : ((numaNodes > 1) ? mem_pagesize() : 0);
+      if (pageSize) {
+        uintptr_t regionEnd = (uintptr_t) end + growth;
+        growth += ((regionEnd + pageSize - 1) & ~(pageSize - 1)) - regionEnd;
       }
-      mb->size = totalFree;
-      assignBlockFooter(mb);
     }
+    // Map the page map's nodes for the new pages first, so that recording their owner below cannot fail
+    if (!pageMapReserve(&pageMap, end, growth)) {
+      return NULL;
+    }
+    void * p = mem_sbrk_cas(end, growth);
+    if (p == (void *) -1) {
+      return NULL;
+    }
+    if (p) {
+      break;
+    }
+    waitForHeapEnd(attempt);
+  }
+  if (numaNodes > 1) {
+    mem_bind_node(end, growth, currentThreadInfo->node);
+  }
+  // Set up the headers before publishing the new end of the heap, which other threads coalesce up to
+  MemoryBlock * mb = (MemoryBlock *) end;
+  if (padding) {
+    mb->size = padding;
+    mb->threadInfo = (void *) currentThreadInfo;
+    mb->isFree = false;
+#ifdef LIFETIME_HEAPS
+    mb->isLongLived = false;
+    mb->site = 0;
+#endif
+    assignBlockFooter(mb);
+    mb = (MemoryBlock *) ((char *) mb + padding);
+  }
+  mb->size = growth - padding;
+  mb->threadInfo = (void *) currentThreadInfo;
+  mb->isFree = false;
+#ifdef LIFETIME_HEAPS
+  mb->isLongLived = false;
+  mb->site = 0;
+#endif
+  assignBlockFooter(mb);
+  pageMapSetRange(&pageMap, end, growth, (void *) currentThreadInfo);
+  waitForHeapEndAt(end);
+  heapTailOwner = (void *) currentThreadInfo;
+  __atomic_store_n(&endOfHeap, (void *) (end + growth), __ATOMIC_RELEASE);
+  if (isNewRegion) {
+    nextRegionSize = (nextRegionSize < MAXIMUM_REGION_SIZE / 2) ? 2 * nextRegionSize : MAXIMUM_REGION_SIZE;
+    truncateMemoryBlock(mb, size);
+  }
+  return mb;
+}
 
-    mb->isFree = true;
+// Helper method, run as the destructor of threadExitKey when a thread exits, that hands the blocks it freed on behalf
+// of other threads over to their owners, and all of the thread's free memory over to the span pool so that the
+// threads still running can reuse it. The thread's record then waits for a new thread to take it over; blocks freed
+// back to it in the meantime are reclaimed by the background thread.
+static void donateThreadHeap(void *) {
+  flushRemoteFreeBatches();
+  ThreadSharedInfo * record = currentThreadInfo;
+  if (!record) {
+    return;
+  }
+  binUnbinnedBlocks(SIZE_MAX);
+  for (int i = 0; i < NUM_OF_THREAD_BINS; i++) {
+    while (bins[i]) {
+      MemoryBlock * mb = bins[i];
+      removeBlockFromBinnedList(mb);
+      donateSpan(mb);
+    }
+  }
+  setThreadCacheLimit(record, THREAD_CACHE_MINIMUM);
+  GLOBAL_LOCK;
+  record->hasExited = true;
+  record->nextExitedThread = exitedThreads;
+  exitedThreads = record;
+  currentThreadInfo = 0;
+  GLOBAL_UNLOCK;
+}
 
-    // Assign to a suitable bin
-    assignBlockToBinnedList(mb);
-    currentThreadInfo.unbinnedBlocks = nextMB;
-    mb = nextMB;
+// Helper method that creates threadExitKey, once per process
+static void createThreadExitKey() {
+  pthread_key_create(&threadExitKey, donateThreadHeap);
+}
+
+// Helper method that returns a record for a new thread: the record of a thread that has exited, which comes with
+// the blocks that still point at it and any blocks freed back to it since, or else a fresh record carved out of a
+// slab. Returns NULL if no slab can be mapped. Called with the global lock held.
+static inline ThreadSharedInfo * takeThreadRecord() {
+  ThreadSharedInfo * record = exitedThreads;
+  if (record) {
+    exitedThreads = record->nextExitedThread;
+    record->hasExited = false;
+    return record;
+  }
+  // Each record starts on a cache line of its own, as other threads take its lock
+  size_t recordSize = (sizeof(ThreadSharedInfo) + CACHE_LINE_SIZE - 1) & ~((size_t) CACHE_LINE_SIZE - 1);
+  if (threadRecordSlabUsed + recordSize > THREAD_RECORD_SLAB_SIZE) {
+    void * slab = mmap(NULL, THREAD_RECORD_SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (slab == MAP_FAILED) {
+      return NULL;
+    }
+    threadRecordSlab = (char *) slab;
+    threadRecordSlabUsed = 0;
   }
-  currentThreadInfo.unbinnedBlocks = 0;
-  pthread_mutex_unlock(&(currentThreadInfo.localLock));
+  record = (ThreadSharedInfo *) (threadRecordSlab + threadRecordSlabUsed);
+  threadRecordSlabUsed += recordSize;
+  adaptiveLockInit(&(record->localLock), canSpinOnLocks);
+  record->unbinnedBlocks = 0;
+  record->hasExited = false;
+  record->operations = 0;
+  record->operationsSeen = 0;
+  record->cacheLimit = THREAD_CACHE_MINIMUM;
+  record->nextThread = threadRegistry;
+  __sync_synchronize(); // The background thread walks the registry without the lock
+  threadRegistry = record;
+  return record;
 }
 
 // Helper method to initialize the state variables of a thread the first time it is run
 static inline void threadInit() {
-  for (int i = 0; i < NUM_OF_BINS; i++) {
+  GLOBAL_LOCK;
+  ThreadSharedInfo * record = takeThreadRecord();
+  GLOBAL_UNLOCK;
+  if (!record) {
+    return;
+  }
+  for (int i = 0; i < NUM_OF_THREAD_BINS; i++) {
     bins[i] = 0;
   }
-  currentThreadInfo.unbinnedBlocks = 0;
-  pthread_mutex_init(&(currentThreadInfo.localLock), NULL);
-  MemoryBlock * mb;
-  GLOBAL_LOCK;
-  void *p = mem_sbrk(INITIAL_ALLOCATION_PER_THREAD);
-  if (p == (void *) -1) {
-    GLOBAL_UNLOCK;
+#ifdef LIFETIME_HEAPS
+  std::memset(allocationSites, 0, sizeof(allocationSites));
+  siteWindowMallocs = 0;
+#endif
+#ifdef RECENT_FIRST_BINS
+  recentlyBinnedBlock = 0;
+#endif
+#ifdef ADDRESS_ORDERED_BINS
+  lastOrderedBlock = 0;
+#endif
+  cachedBytes = 0;
+  mallocsInEpoch = 0;
+  cacheMissesInEpoch = 0;
+  // The thread's heap comes from the arena of the node it starts on
+  unsigned int cpu, node;
+  record->node = (numaNodes > 1 && getcpu(&cpu, &node) == 0 && (int) node < numaNodes) ? node : 0;
+  currentThreadInfo = record;
+  pthread_setspecific(threadExitKey, (void *) record);
+  MemoryBlock * mb = growHeap(INITIAL_ALLOCATION_PER_THREAD);
+  if (!mb) {
     return;
   }
-  mb = (MemoryBlock *) endOfHeap;
-  endOfHeap += INITIAL_ALLOCATION_PER_THREAD;
-  GLOBAL_UNLOCK;
-  mb->size = INITIAL_ALLOCATION_PER_THREAD;
-  mb->threadInfo = (void *) &currentThreadInfo;
   mb->isFree = true;
-  assignBlockFooter(mb);
   assignBlockToBinnedList(mb);
-  isInitialized = true;
 }
 
   //  malloc - Allocate a block of the requested size.
   //  Ensures block size is a multiple of the alignment.
 void * allocator::malloc(size_t size) {
-  if (!isInitialized) {
+  if (size > MAXIMUM_REQUEST_SIZE) {
+    return NULL;
+  }
+  if (!currentThreadInfo) {
     threadInit();
+    if (!currentThreadInfo) {
+      return NULL;
+    }
+  }
+  currentThreadInfo->operations++;
+  if (++mallocsInEpoch == THREAD_CACHE_EPOCH) {
+    endThreadCacheEpoch();
   }
+  flushStaleRemoteFreeBatches();
   void * currentLoc;
   size_t alignedSize = ALIGN(size + ALLOCATED_BLOCK_OVERHEAD);
   alignedSize = (alignedSize > MINIMUM_ALLOCATED_BLOCK_SIZE)? alignedSize : MINIMUM_ALLOCATED_BLOCK_SIZE;
   MemoryBlock * currentLocMB;
+#ifdef PER_CPU_CACHES
+  if (perCpuCachesEnabled && alignedSize <= PER_CPU_MAXIMUM_BLOCK_SIZE) {
+    currentLocMB = (MemoryBlock *) percpuPop(perCpuCaches, getPerCpuClass(alignedSize));
+    if (currentLocMB) {
+      return MB_ADDRESS_TO_INTERNAL_SPACE_ADDRESS(currentLocMB);
+    }
+  }
+#endif
   int i = getBinIndex(alignedSize);
-  binAllUnbinnedBlocks();
+  int endBin = NUM_OF_BINS;
+  binUnbinnedBlocks(UNBINNED_BLOCK_BUDGET);
+#ifdef LIFETIME_HEAPS
+  // Small blocks predicted to be long-lived come from the bins of the long-lived heap
+  int site = 0;
+  bool isLongLived = false;
+  if (alignedSize < LARGE_BLOCK_THRESHOLD) {
+    site = getAllocationSite(__builtin_return_address(0));
+    isLongLived = countSiteAllocation(site);
+    if (isLongLived) {
+      i += NUM_OF_BINS;
+      endBin += NUM_OF_BINS;
+    }
+  }
+#endif
 
-  // Look through existing free blocks in binned lists to see if any of them can be recycled
-  while (i < NUM_OF_BINS) {
+  // Look through existing free blocks in binned lists to see if any of them can be recycled. Large blocks come
+  // from the span pool instead, in whole pages.
+  if (alignedSize >= LARGE_BLOCK_THRESHOLD) {
+    alignedSize = (alignedSize + LARGE_BLOCK_UNIT - 1) & ~(size_t) (LARGE_BLOCK_UNIT - 1);
+    i = endBin;
+  }
+#ifdef RECENT_FIRST_BINS
+  int firstBin = i;
+#endif
+  while (i < endBin) {
     currentLoc = bins[i];
     currentLocMB = (MemoryBlock *) bins[i];
     while (currentLoc) {
       if (currentLocMB->size >= alignedSize) {
         // Found a match
+        removeBlockFromBinnedList(currentLocMB);
         truncateMemoryBlock(currentLocMB, alignedSize);
-        removeBlockFromLinkedList(currentLocMB, bins[i]);
         currentLocMB->isFree = false;
-        assert(currentLocMB->threadInfo == (void *) &currentThreadInfo);
+#ifdef LIFETIME_HEAPS
+        currentLocMB->site = site;
+#endif
+        assert(currentLocMB->threadInfo == (void *) currentThreadInfo);
         return MB_ADDRESS_TO_INTERNAL_SPACE_ADDRESS(currentLoc);
       }
       currentLocMB = currentLocMB->nextFreeBlock;
       currentLoc = (void *) currentLocMB;
     }
+#ifdef RECENT_FIRST_BINS
+    // Nothing in the block's own bin fits. Rather than spill to the next bin that has blocks, reuse the block
+    // binned last if it fits, as it is likely still in cache.
+    currentLocMB = recentlyBinnedBlock;
+    if (i == firstBin && currentLocMB && currentLocMB->size >= alignedSize) {
+      removeBlockFromBinnedList(currentLocMB);
+      truncateMemoryBlock(currentLocMB, alignedSize);
+      currentLocMB->isFree = false;
+#ifdef LIFETIME_HEAPS
+      currentLocMB->site = site;
+#endif
+      return MB_ADDRESS_TO_INTERNAL_SPACE_ADDRESS(currentLocMB);
+    }
+#endif
     i++;
   }
 
-  // Did not find a free block that can be recycled. Must ask mem_sbrk for memory.
-  GLOBAL_LOCK;
-  void *p = mem_sbrk(alignedSize);
-  if (p == (void *) -1) {
-    GLOBAL_UNLOCK;
+  // Did not find a free block that can be recycled. Take over a span from the span pool, or failing that,
+  // ask mem_sbrk for memory. Whatever a small block brings along is binned, and the cache limit grows by it all.
+  size_t cachedBefore = cachedBytes;
+  size_t freshSize = alignedSize;
+  bool isRegion = alignedSize < LARGE_BLOCK_THRESHOLD;
+#ifdef LIFETIME_HEAPS
+  // The long-lived heap grows by LONG_LIVED_REGION_SIZE at a time rather than by regions
+  if (isLongLived) {
+    freshSize += LONG_LIVED_REGION_SIZE;
+    isRegion = false;
+  }
+#endif
+  currentLocMB = takeSpan(freshSize, isRegion);
+  if (!currentLocMB) {
+    currentLocMB = growHeap(freshSize);
+  }
+  if (!currentLocMB) {
     return NULL;
   }
-  currentLoc = endOfHeap;
-  endOfHeap += alignedSize;
-  GLOBAL_UNLOCK;
-  currentLocMB = (MemoryBlock *) currentLoc;
-  currentLocMB->size = alignedSize;
-  currentLocMB->threadInfo = (void *) &currentThreadInfo;
-  currentLocMB->isFree = false;
-  assignBlockFooter(currentLocMB);
-  return MB_ADDRESS_TO_INTERNAL_SPACE_ADDRESS(currentLoc);
+#ifdef LIFETIME_HEAPS
+  // The memory taken beyond the block joins the block's heap
+  currentLocMB->isLongLived = isLongLived;
+  truncateMemoryBlock(currentLocMB, alignedSize);
+  currentLocMB->site = site;
+#endif
+  if (alignedSize < LARGE_BLOCK_THRESHOLD) {
+    cacheMissesInEpoch++;
+    growThreadCacheLimit(currentLocMB->size + cachedBytes - cachedBefore);
+  }
+  return MB_ADDRESS_TO_INTERNAL_SPACE_ADDRESS(currentLocMB);
 }
 
-// free - Simply bins the block that needs to be freed if this thread owns it; otherwise, 
-// assigns it to the owner thread's unbinned list
+// memalign - Allocate a block whose internal space starts at a multiple of alignment (a power of two).
+// Over-allocates so that the aligned internal space can be preceded by a free block carved off the front.
+void * allocator::memalign(size_t alignment, size_t size) {
+  if (alignment <= ALIGNMENT) {
+    return malloc(size);
+  }
+  if (size > MAXIMUM_REQUEST_SIZE || alignment > MAXIMUM_REQUEST_SIZE) {
+    return NULL;
+  }
+  void * ptr = malloc(size + alignment + MINIMUM_ALLOCATED_BLOCK_SIZE);
+  if (!ptr) {
+    return NULL;
+  }
+  size_t alignedSize = ALIGN(size + ALLOCATED_BLOCK_OVERHEAD);
+  alignedSize = (alignedSize > MINIMUM_ALLOCATED_BLOCK_SIZE)? alignedSize : MINIMUM_ALLOCATED_BLOCK_SIZE;
+  MemoryBlock * mb = INTERNAL_SPACE_ADDRESS_TO_MB_ADDRESS(ptr);
+  uintptr_t alignedPtr = ((uintptr_t) ptr + alignment - 1) & ~((uintptr_t) alignment - 1);
+  if (alignedPtr != (uintptr_t) ptr) {
+    // The skipped front part must be big enough to stand as a free block of its own
+    while (alignedPtr - (uintptr_t) ptr < MINIMUM_ALLOCATED_BLOCK_SIZE) {
+      alignedPtr += alignment;
+    }
+    MemoryBlock * alignedMB = INTERNAL_SPACE_ADDRESS_TO_MB_ADDRESS(alignedPtr);
+    uint32_t frontSize = (char *) alignedMB - (char *) mb;
+    alignedMB->size = mb->size - frontSize;
+    alignedMB->threadInfo = mb->threadInfo;
+    alignedMB->isFree = false;
+#ifdef LIFETIME_HEAPS
+    alignedMB->isLongLived = mb->isLongLived;
+    alignedMB->site = mb->site;
+    mb->site = 0;
+#endif
+    assignBlockFooter(alignedMB);
+    mb->size = frontSize;
+    assignBlockFooter(mb);
+    assignBlockToOwner(mb);
+    mb = alignedMB;
+  }
+  truncateMemoryBlock(mb, alignedSize);
+  return MB_ADDRESS_TO_INTERNAL_SPACE_ADDRESS(mb);
+}
+
+// free - Hands a large block straight back to the span pool, whichever thread owns it. Otherwise, coalesces the
+// block that needs to be freed with the free blocks around it and bins the result if this thread owns it, and bins
+// whatever other threads have freed back to this one in the meantime, or else adds the block to this thread's batch
+// for the owner, which joins the owner's unbinned list once it is full. With PER_CPU_CACHES, a small block is first
+// offered to the cache of the CPU it is freed on, whichever thread owns it. With LIFETIME_HEAPS, only blocks of the
+// same heap coalesce.
 void allocator::free(void *ptr) {
   MemoryBlock * mb;
   mb = INTERNAL_SPACE_ADDRESS_TO_MB_ADDRESS(ptr);
   assert(!mb->isFree);
-  mb->isFree = true;
-  if (mb->threadInfo == &currentThreadInfo) {
-    assignBlockToBinnedList(mb);
+  flushStaleRemoteFreeBatches();
+#ifdef PER_CPU_CACHES
+  if (perCpuCachesEnabled && mb->size <= PER_CPU_MAXIMUM_BLOCK_SIZE &&
+      percpuPush(perCpuCaches, getPerCpuClass(mb->size), (void *) mb)) {
+    return;
+  }
+#endif
+  // A thread that has never allocated owns no blocks, and hands each of them to its owner
+  if (mb->size >= LARGE_BLOCK_THRESHOLD) {
+    donateSpan(mb);
+  } else if (mb->threadInfo == currentThreadInfo) {
+    currentThreadInfo->operations++;
+    coalesceAndBinBlock(mb);
+    binUnbinnedBlocks(UNBINNED_BLOCK_BUDGET);
+    if (cachedBytes > currentThreadInfo->cacheLimit) {
+      scavengeThreadCache();
+    }
   } else {
-    assignBlockToThreadSpecificUnbinnedList(mb);
+    addBlockToRemoteFreeBatch(mb);
   }
   return;
 }
 
+// drain_remote_frees - Hands the blocks that the calling thread has freed on behalf of other threads over to their
+// owners, and bins every block that other threads have handed back to it. malloc and free only bin a bounded number
+// of them per call, and only hand blocks over in full batches; a thread can call this when it is idle to catch up.
+void allocator::drain_remote_frees() {
+  flushRemoteFreeBatches();
+  if (currentThreadInfo) {
+    binUnbinnedBlocks(SIZE_MAX);
+  }
+}
+
+// Helper method that hands up to budget blocks from the front of the unbinned list of a thread that has exited or
+// gone idle over to the span pool, as that thread is not going to bin them. Returns how many blocks it handed over.
+static size_t reclaimUnbinnedBlocks(ThreadSharedInfo * record, size_t budget) {
+  adaptiveLock(&(record->localLock));
+  MemoryBlock * mb = record->unbinnedBlocks;
+  if (!mb) {
+    adaptiveUnlock(&(record->localLock));
+    return 0;
+  }
+  MemoryBlock * lastMB = mb;
+  for (size_t n = 1; n < budget && lastMB->nextFreeBlock; n++) {
+    lastMB = lastMB->nextFreeBlock;
+  }
+  record->unbinnedBlocks = lastMB->nextFreeBlock;
+  if (record->unbinnedBlocks) {
+    record->unbinnedBlocks->previousFreeBlock = 0;
+  }
+  lastMB->nextFreeBlock = 0;
+  adaptiveUnlock(&(record->localLock));
+
+  size_t reclaimed = 0;
+  while (mb) {
+    assert(!mb->isFree);
+    MemoryBlock * nextUnbinnedMB = mb->nextFreeBlock;
+    donateSpan(mb);
+    reclaimed++;
+    mb = nextUnbinnedMB;
+  }
+  return reclaimed;
+}
+
+// Helper method that hands the pages inside up to budget spans of the span pools, that are at least PURGE_THRESHOLD
+// big and have not been purged yet, back to the kernel. The spans stay in their pools. With SPAN_DESCRIPTORS, only
+// the descriptors are read, and the kernel takes the pages back lazily, when it runs short of memory.
+static void purgeSpanPools(size_t budget) {
+  for (int node = 0; node < numaNodes && budget; node++) {
+    SpanPool * pool = &spanPools[node];
+    adaptiveLock(&(pool->lock));
+#ifdef SPAN_DESCRIPTORS
+    for (SpanDescriptor * descriptor = pool->spans; descriptor < pool->spans + pool->numSpans && budget; descriptor++) {
+      if (descriptor->size >= PURGE_THRESHOLD && !descriptor->isPurged) {
+        mem_purge_lazy((char *) descriptor->span + sizeof(MemoryBlock), descriptor->size - FREE_BLOCK_OVERHEAD);
+        descriptor->isPurged = true;
+        budget--;
+      }
+    }
+#else
+    for (int i = getBinIndex(PURGE_THRESHOLD); i < NUM_OF_BINS && budget; i++) {
+      for (MemoryBlock * span = pool->bins[i]; span && budget; span = span->nextFreeBlock) {
+        if (span->size >= PURGE_THRESHOLD && !span->isPurged) {
+          mem_purge((char *) span + sizeof(MemoryBlock), span->size - FREE_BLOCK_OVERHEAD);
+          span->isPurged = true;
+          budget--;
+        }
+      }
+    }
+#endif
+    adaptiveUnlock(&(pool->lock));
+  }
+}
+
+// Helper method that cuts the span that ends the heap off it, if the span is free and at least TRIM_THRESHOLD big,
+// and has memlib decommit its pages. Returns whether it did. The new end of the heap is published before the brk is
+// lowered, so that no thread still waiting for the old end takes it for the end of its predecessor's reservation;
+// threads growing the heap in between fail to reserve the brk and wait, as they do for any reservation. The span's
+// header stays committed, since threads that free the block below it may still read it.
+static bool trimHeapTop() {
+  MemoryBlock * end = (MemoryBlock *) endOfHeap;
+  if ((void *) end == memoryStart) {
+    return false;
+  }
+  MemoryBlock * top = (MemoryBlock *) ((char *) end - *MB_ADDRESS_TO_PREVIOUS_FOOTER_ADDRESS(end));
+  if ((void *) top < memoryStart || top >= end) {
+    return false;
+  }
+  void * owner = top->threadInfo;
+  for (int node = 0; node < numaNodes; node++) {
+    SpanPool * pool = &spanPools[node];
+    if (owner != (void *) pool) {
+      continue;
+    }
+    // Under the pool's lock, its spans and their footers cannot change, so the span is found again from the footer;
+    // the header found before may be one that coalescing left inside a bigger span
+    adaptiveLock(&(pool->lock));
+    top = (MemoryBlock *) ((char *) end - *MB_ADDRESS_TO_PREVIOUS_FOOTER_ADDRESS(end));
+    bool isPublished = endOfHeap == end && (void *) top >= memoryStart && top->threadInfo == (void *) pool &&
+                       top->isFree && top->size >= TRIM_THRESHOLD && (char *) top + top->size == (char *) end &&
+#ifdef SPAN_DESCRIPTORS
+                       top->spanIndex < pool->numSpans && pool->spans[top->spanIndex].span == top &&
+#endif
+                       __sync_bool_compare_and_swap(&endOfHeap, (void *) end, (void *) top);
+    if (isPublished) {
+      heapTailOwner = (void *) pool;
+    }
+    bool isTrimmed = isPublished && mem_sbrk_cas(end, -(int) top->size) == (void *) end;
+    if (isTrimmed) {
+      removeSpanFromPool(pool, top);
+      pool->freeBytes -= top->size;
+      mem_trim(sizeof(MemoryBlock));
+    } else if (isPublished) {
+      // A thread reserved the brk first; it publishes the heap past the span once the old end is back
+      __sync_bool_compare_and_swap(&endOfHeap, (void *) top, (void *) end);
+    }
+    adaptiveUnlock(&(pool->lock));
+    return isTrimmed;
+  }
+  return false;
+}
+
+// Helper method, run by the background thread once per interval, that reclaims the blocks freed back to threads
+// that have exited or made no call to malloc or free since the previous pass, cuts the cache limits of those threads
+// back to the minimum, trims the top of the heap, and then purges the span pools. Starting a pass also asks every
+// thread to hand its batches of remote frees over on its next call to malloc or free.
+// The budget bounds the number of blocks and spans that one pass handles.
+static void runMaintenancePass(size_t budget) {
+  __sync_fetch_and_add(&maintenanceEpoch, 1);
+  for (ThreadSharedInfo * record = threadRegistry; record && budget; record = record->nextThread) {
+    uint64_t operations = record->operations;
+    bool isIdle = record->hasExited || operations == record->operationsSeen;
+    record->operationsSeen = operations;
+    if (isIdle && record->cacheLimit > THREAD_CACHE_MINIMUM) {
+      // An idle thread hands its excess over on its next call to free
+      setThreadCacheLimit(record, THREAD_CACHE_MINIMUM);
+    }
+    if (isIdle && record->unbinnedBlocks) {
+      budget -= reclaimUnbinnedBlocks(record, budget);
+    }
+  }
+  if (budget && trimHeapTop()) {
+    budget--;
+  }
+  purgeSpanPools(budget);
+}
+
+// Helper method that is the body of the background thread
+static void * backgroundMaintenance(void *) {
+  pthread_mutex_lock(&backgroundLock);
+  while (isBackgroundRunning) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += backgroundInterval / 1000;
+    deadline.tv_nsec += (long) (backgroundInterval % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&backgroundWakeup, &backgroundLock, &deadline);
+    if (!isBackgroundRunning) {
+      break;
+    }
+    size_t budget = backgroundBudget;
+    pthread_mutex_unlock(&backgroundLock);
+    runMaintenancePass(budget);
+    pthread_mutex_lock(&backgroundLock);
+  }
+  pthread_mutex_unlock(&backgroundLock);
+  return NULL;
+}
+
+// start_background_thread - Starts a thread that, every intervalMillis milliseconds, moves the blocks freed back to
+// exited or idle threads over to the span pools and hands the pages of large pooled spans back to the kernel,
+// handling at most budget blocks and spans per pass. If the thread is already running, only its settings change.
+// Returns 0 on success, or the error from pthread_create. init stops the thread while it sets the heap up again.
+int allocator::start_background_thread(unsigned int intervalMillis, size_t budget) {
+  pthread_mutex_lock(&backgroundLock);
+  backgroundInterval = intervalMillis ? intervalMillis : 1;
+  backgroundBudget = budget ? budget : 1;
+  int result = 0;
+  if (!isBackgroundRunning) {
+    isBackgroundRunning = true;
+    result = pthread_create(&backgroundThread, NULL, backgroundMaintenance, NULL);
+    if (result) {
+      isBackgroundRunning = false;
+    }
+  }
+  pthread_mutex_unlock(&backgroundLock);
+  return result;
+}
+
+// stop_background_thread - Stops the background thread, if it is running, and waits for it to finish its pass
+void allocator::stop_background_thread() {
+  pthread_mutex_lock(&backgroundLock);
+  if (!isBackgroundRunning) {
+    pthread_mutex_unlock(&backgroundLock);
+    return;
+  }
+  isBackgroundRunning = false;
+  pthread_cond_signal(&backgroundWakeup);
+  pthread_mutex_unlock(&backgroundLock);
+  pthread_join(backgroundThread, NULL);
+}
+
+// prepare_fork - Takes every lock of the allocator, so that a child forked next starts with consistent heap state.
+// To be registered with pthread_atfork, along with parent_after_fork and child_after_fork.
+void allocator::prepare_fork() {
+  pthread_mutex_lock(&backgroundLock);
+  GLOBAL_LOCK;
+  for (ThreadSharedInfo * record = threadRegistry; record; record = record->nextThread) {
+    adaptiveLock(&(record->localLock));
+  }
+  for (int node = 0; node < numaNodes; node++) {
+    adaptiveLock(&(spanPools[node].lock));
+  }
+}
+
+// parent_after_fork - Releases the locks taken by prepare_fork in the parent
+void allocator::parent_after_fork() {
+  for (int node = numaNodes - 1; node >= 0; node--) {
+    adaptiveUnlock(&(spanPools[node].lock));
+  }
+  for (ThreadSharedInfo * record = threadRegistry; record; record = record->nextThread) {
+    adaptiveUnlock(&(record->localLock));
+  }
+  GLOBAL_UNLOCK;
+  pthread_mutex_unlock(&backgroundLock);
+}
+
+// Helper method, run in a child after a fork, that hands memory reserved at the end of the heap by a thread of the
+// parent, but not yet published, over to the span pool of the first node. That thread does not exist in the child,
+// and growHeap would otherwise wait for it forever. memlib commits the memory first, since a trim may have
+// decommitted it before the thread could commit it again; if it cannot, the memory is cut off the heap instead.
+static void reclaimHeapReservation() {
+  char * brk = (char *) mem_heap_hi() + 1;
+  bool isCommitted = mem_child_after_fork() == 0;
+  if (brk == (char *) endOfHeap) {
+    return;
+  }
+  if (!isCommitted) {
+    mem_sbrk_cas(brk, (int) ((char *) endOfHeap - brk));
+    return;
+  }
+  SpanPool * pool = &spanPools[0];
+  MemoryBlock * mb = (MemoryBlock *) endOfHeap;
+  mb->size = brk - (char *) mb;
+  mb->threadInfo = (void *) pool;
+  mb->isFree = true;
+#ifdef LIFETIME_HEAPS
+  mb->isLongLived = false;
+  mb->site = 0;
+#endif
+  assignBlockFooter(mb);
+  pageMapSetRange(&pageMap, mb, mb->size, (void *) pool);
+  if (addSpanToPool(pool, mb, false)) {
+    pool->freeBytes += mb->size;
+  } else {
+    mb->isFree = false;
+  }
+  heapTailOwner = (void *) pool;
+  endOfHeap = brk;
+}
+
+// child_after_fork - Sets the locks taken by prepare_fork up afresh in the child, where only the thread that forked
+// is left. The background thread is not running in the child; it can be started again.
+void allocator::child_after_fork() {
+  adaptiveLockInit(&globalLock, canSpinOnLocks);
+  for (ThreadSharedInfo * record = threadRegistry; record; record = record->nextThread) {
+    adaptiveLockInit(&(record->localLock), canSpinOnLocks);
+  }
+  for (int node = 0; node < numaNodes; node++) {
+    adaptiveLockInit(&(spanPools[node].lock), canSpinOnLocks);
+  }
+  pthread_mutex_init(&backgroundLock, NULL);
+  pthread_cond_init(&backgroundWakeup, NULL);
+  isBackgroundRunning = false;
+  reclaimHeapReservation();
+}
+
+// Helper method that adds the counters of one lock to stats
+static inline void addLockStats(lock_stats * stats, AdaptiveLock * lock) {
+  stats->acquisitions += lock->acquisitions;
+  stats->contentions += lock->contentions;
+  stats->parks += lock->parks;
+}
+
+// get_lock_stats - Sums the counters of the global lock, the span pool locks and every thread's local lock. The
+// counters are read without the locks, so they are only a snapshot.
+void allocator::get_lock_stats(lock_stats * stats) {
+  stats->acquisitions = 0;
+  stats->contentions = 0;
+  stats->parks = 0;
+  addLockStats(stats, &globalLock);
+  for (int node = 0; node < numaNodes; node++) {
+    addLockStats(stats, &(spanPools[node].lock));
+  }
+  for (ThreadSharedInfo * record = threadRegistry; record; record = record->nextThread) {
+    addLockStats(stats, &(record->localLock));
+  }
+}
+
+// set_allocation_site - Makes the calling thread's following calls to malloc count as made at the given allocation
+// site rather than at their return address, or at their return address again if site is 0. Tools that replay
+// traces, which record no call sites, use it to feed the lifetime predictions of LIFETIME_HEAPS builds; other builds
+// ignore it.
+void allocator::set_allocation_site(size_t site) {
+#ifdef LIFETIME_HEAPS
+  allocationSiteOverride = site;
+#endif
+}
+
+// usable_size - Returns the number of bytes of internal space in an allocated block, which may exceed the size requested
+size_t allocator::usable_size(void *ptr) {
+  MemoryBlock * mb = INTERNAL_SPACE_ADDRESS_TO_MB_ADDRESS(ptr);
+  return mb->size - ALLOCATED_BLOCK_OVERHEAD;
+}
+
+// owns - Returns whether ptr lies on a page of the heap. Only the page map is read, so ptr may be any address.
+bool allocator::owns(void *ptr) {
+  return ptr < endOfHeap && pageMapGet(&pageMap, ptr) != NULL;
+}
+
 // realloc - Implemented using special cases to save the need for copying memory contents or calling both malloc and free
 void * allocator::realloc(void *ptr, size_t size) {
-  
+  if (size > MAXIMUM_REQUEST_SIZE) {
+    return NULL;
+  }
+
   MemoryBlock * mb = INTERNAL_SPACE_ADDRESS_TO_MB_ADDRESS(ptr);
   size_t alignedSize = ALIGN(size + ALLOCATED_BLOCK_OVERHEAD);
   alignedSize = (alignedSize > MINIMUM_ALLOCATED_BLOCK_SIZE)? alignedSize : MINIMUM_ALLOCATED_BLOCK_SIZE;
+  // Large blocks come in whole pages, as they do from malloc
+  if (alignedSize >= LARGE_BLOCK_THRESHOLD) {
+    alignedSize = (alignedSize + LARGE_BLOCK_UNIT - 1) & ~(size_t) (LARGE_BLOCK_UNIT - 1);
+  }
   
-  // Case when new size is less than the existing size of the block and the same block can be returned as is
-  if (alignedSize < mb->size) {
-    truncateMemoryBlock(mb, alignedSize);
+  // Case when new size is less than the existing size of the block and the same block can be returned as is.
+  // A large block only shrinks in place while it stays large; the pages it no longer needs go back to the span pool.
+  if (alignedSize < mb->size && (mb->size < LARGE_BLOCK_THRESHOLD || alignedSize >= LARGE_BLOCK_THRESHOLD)) {
+    if (mb->size >= LARGE_BLOCK_THRESHOLD) {
+      truncateLargeBlock(mb, alignedSize);
+    } else {
+      truncateMemoryBlock(mb, alignedSize);
+    }
     return MB_ADDRESS_TO_INTERNAL_SPACE_ADDRESS(mb);
   }
 
-  // Case when new size is greater than existing size..
-  if (alignedSize > mb->size) {
+  // Case when new size is greater than existing size, or a large block becomes a small one..
+  if (alignedSize != mb->size) {
     MemoryBlock * nextMB = (MemoryBlock *) ((char *) mb + mb->size);
-    // .. but the block to the right in memory is also free and can be used to satisfy the reallocation
-    if (nextMB != endOfHeap && nextMB->threadInfo == mb->threadInfo && nextMB->isFree && (mb->size + nextMB->size) >= alignedSize) {
-      MemoryBlock * t = currentThreadInfo.unbinnedBlocks;
-      MemoryBlock ** listHead = &bins[getBinIndex(nextMB->size)];
-      while (t) {
-        if (nextMB == t) {
-          listHead = &(currentThreadInfo.unbinnedBlocks);
-          break;
-        }
-        t = t->nextFreeBlock;
-      }
-      removeBlockFromLinkedList(nextMB, *listHead);
+    // .. but the block to the right in memory is also free and can be used to satisfy the reallocation.
+    // Blocks waiting in the unbinned list are marked as allocated, so a free block is always in a bin.
+    if (alignedSize > mb->size && nextMB != endOfHeap && mb->threadInfo == currentThreadInfo && isFreeBlockOwnedBy(nextMB, mb->threadInfo) &&
+        canCoalesceWith(nextMB, mb) && (mb->size + nextMB->size) >= alignedSize) {
+      removeBlockFromBinnedList(nextMB);
       mb->size = mb->size + nextMB->size;
       assignBlockFooter(mb);
       truncateMemoryBlock(mb, alignedSize);
       return MB_ADDRESS_TO_INTERNAL_SPACE_ADDRESS(mb);
     }
     else {
-      GLOBAL_LOCK;
       // Case when the block we need to reallocate is located at the end of the memory heap, 
-      // thereby allowing us to call mem_sbrk on  only the required difference in size
-      if ((char *) mb + mb->size == (char *) endOfHeap) {
-        size_t neededAllocation = alignedSize - mb->size;
-        void *p = mem_sbrk(neededAllocation);
+      // thereby allowing us to reserve only the required difference in size, the same way growHeap does
+      char * end = (char *) mb + mb->size;
+      for (int attempt = 0; alignedSize > mb->size && end == (char *) endOfHeap; attempt++) {
+        if (!pageMapReserve(&pageMap, end, alignedSize - mb->size)) {
+          return NULL;
+        }
+        void * p = mem_sbrk_cas(end, alignedSize - mb->size);
         if (p == (void *) -1) {
-          GLOBAL_UNLOCK;
           return NULL;
         }
-        endOfHeap += neededAllocation;
-        GLOBAL_UNLOCK;
-        mb->size = alignedSize;
-        assignBlockFooter(mb);
-        return MB_ADDRESS_TO_INTERNAL_SPACE_ADDRESS(mb);
+        if (p) {
+          pageMapSetRange(&pageMap, end, alignedSize - mb->size, mb->threadInfo);
+          mb->size = alignedSize;
+          assignBlockFooter(mb);
+          waitForHeapEndAt(end);
+          __atomic_store_n(&endOfHeap, (void *) ((char *) mb + alignedSize), __ATOMIC_RELEASE);
+          return MB_ADDRESS_TO_INTERNAL_SPACE_ADDRESS(mb);
+        }
+        waitForHeapEnd(attempt);
       }
 
       // Case when no special cases work and the only way to reallocate is to call malloc followed by free
-      GLOBAL_UNLOCK;
       void * newptr = malloc(size);
       if (!newptr) {
         return NULL;
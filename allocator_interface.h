@@ -25,6 +25,9 @@
 #ifndef _ALLOCATOR_INTERFACE_H
 #define _ALLOCATOR_INTERFACE_H
 
+// Size of a cache line, which the allocator and my::object_pool lay their memory out by
+#define CACHE_LINE_SIZE 64
+
 namespace my {
   class allocator_interface { // NOLINT
   public:
@@ -45,12 +48,30 @@ namespace my {
     void * heap_hi();
   };
 
+  // Counters of the allocator's locks, summed over all of them (see adaptive_lock.h)
+  struct lock_stats {
+    unsigned long long acquisitions;
+    unsigned long long contentions; // acquisitions that found the lock taken
+    unsigned long long parks; // times a thread slept on a lock
+  };
+
   class allocator : public virtual allocator_interface {
   public:
     static int init();
     static void * malloc(size_t size);
+    static void * memalign(size_t alignment, size_t size);
     static void * realloc(void *ptr, size_t size);
     static void free(void *ptr);
+    static size_t usable_size(void *ptr);
+    static bool owns(void *ptr);
+    static void drain_remote_frees();
+    static int start_background_thread(unsigned int intervalMillis, size_t budget);
+    static void stop_background_thread();
+    static void prepare_fork();
+    static void parent_after_fork();
+    static void child_after_fork();
+    static void get_lock_stats(lock_stats * stats);
+    static void set_allocation_site(size_t site);
     static int check();
     void reset_brk();
     void * heap_lo();
@@ -69,5 +90,31 @@ namespace my {
     void * heap_lo();
     void * heap_hi();
   };
+
+  // A binary buddy allocator, for comparing the speed and fragmentation of a simpler design in mdriver
+  class buddy_allocator : public virtual allocator_interface {
+  public:
+    static int init();
+    static void * malloc(size_t size);
+    static void * realloc(void *ptr, size_t size);
+    static void free(void *ptr);
+    static int check();
+    void reset_brk();
+    void * heap_lo();
+    void * heap_hi();
+  };
+
+  // A two-level segregated fit allocator, whose malloc and free take constant time
+  class tlsf_allocator : public virtual allocator_interface {
+  public:
+    static int init();
+    static void * malloc(size_t size);
+    static void * realloc(void *ptr, size_t size);
+    static void free(void *ptr);
+    static int check();
+    void reset_brk();
+    void * heap_lo();
+    void * heap_hi();
+  };
 };
 #endif  // _ALLOCATOR_INTERFACE_H
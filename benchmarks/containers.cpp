@@ -0,0 +1,117 @@
+/**
+ *
+ * containers runs a container-heavy workload (map, unordered_map, string
+ * and vector) once per allocator: std::allocator, my::stl_allocator,
+ * my::memory_resource, and a my::monotonic_resource arena.
+ *
+ * Try the following:
+ *
+ *  containers 20000 5
+ *
+ *  Written for Fall 2012 by 6.172 Staff
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "timer.h"
+
+#include "../wrapper.cpp"
+#include "../stl_allocator.h"
+
+// Hashes any basic_string by its characters, whatever allocator it uses
+struct StringHash {
+  template <class String>
+  size_t operator() (const String & s) const {
+    return std::hash<std::string_view>() (std::string_view (s.data(), s.size()));
+  }
+};
+
+// Runs one round of the workload with containers whose allocators are rebound from alloc
+template <class CharAlloc>
+static long workload (int n, const CharAlloc & alloc)
+{
+  typedef std::allocator_traits<CharAlloc> traits;
+  typedef std::basic_string<char, std::char_traits<char>, CharAlloc> String;
+  typedef typename traits::template rebind_alloc<std::pair<const int, String> > MapAlloc;
+  typedef typename traits::template rebind_alloc<std::pair<const String, int> > HashAlloc;
+  typedef typename traits::template rebind_alloc<int> VectorAlloc;
+
+  std::map<int, String, std::less<int>, MapAlloc> tree ((std::less<int>()), MapAlloc (alloc));
+  std::unordered_map<String, int, StringHash, std::equal_to<String>, HashAlloc> table (0, StringHash(), std::equal_to<String>(), HashAlloc (alloc));
+  std::vector<int, VectorAlloc> vector ((VectorAlloc (alloc)));
+  long checksum = 0;
+
+  for (int i = 0; i < n; i++) {
+    char buffer[64];
+    snprintf (buffer, sizeof(buffer), "key-%d-padded-beyond-the-small-string-buffer", i);
+    String key (buffer, alloc);
+    tree.insert (std::make_pair (i, key));
+    table.insert (std::make_pair (key, i));
+    vector.push_back (i);
+  }
+  // Drop every other element to interleave frees with the remaining live objects
+  for (int i = 0; i < n; i += 2) {
+    tree.erase (i);
+  }
+  for (typename std::map<int, String, std::less<int>, MapAlloc>::iterator it = tree.begin(); it != tree.end(); ++it) {
+    checksum += table[it->second] + (long) it->second.size();
+  }
+  return checksum + (long) vector.size();
+}
+
+// Times rounds repetitions of the workload
+template <class CharAlloc>
+static double run (int n, int rounds, const CharAlloc & alloc, long * checksum)
+{
+  HL::Timer t;
+  t.start();
+  for (int i = 0; i < rounds; i++) {
+    *checksum += workload (n, alloc);
+  }
+  t.stop();
+  return (double) t;
+}
+
+
+int main (int argc, char * argv[])
+{
+  int n;
+  int rounds;
+
+  if (argc > 2) {
+    n = atoi(argv[1]);
+    rounds = atoi(argv[2]);
+  } else {
+    fprintf (stderr, "Usage: %s elements rounds\n", argv[0]);
+    return 1;
+  }
+
+  // The adapters call my::allocator directly, which must be set up even in the libc build.
+  my_malloc_init();
+
+  long checksum = 0;
+  double stdTime = run (n, rounds, std::allocator<char>(), &checksum);
+  double myTime = run (n, rounds, my::stl_allocator<char>(), &checksum);
+  double pmrTime = run (n, rounds, std::pmr::polymorphic_allocator<char> (my::get_memory_resource()), &checksum);
+  double arenaTime = 0;
+  for (int i = 0; i < rounds; i++) {
+    my::monotonic_resource arena;
+    arenaTime += run (n, 1, std::pmr::polymorphic_allocator<char> (&arena), &checksum);
+  }
+
+  printf ("std::allocator: time elapsed = %f seconds.\n", stdTime);
+  printf ("my::stl_allocator: time elapsed = %f seconds.\n", myTime);
+  printf ("my::memory_resource: time elapsed = %f seconds.\n", pmrTime);
+  printf ("my::monotonic_resource: time elapsed = %f seconds.\n", arenaTime);
+  printf ("Checksum = %ld\n", checksum);
+  end_program();
+  return 0;
+}
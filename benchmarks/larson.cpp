@@ -122,33 +122,6 @@ typedef int SBIT32;
 
 #include "SmpHeap.hpp"
 SMP_HEAP theFastHeap (1024 * 1024, true, true, true);
-
-void * operator new( unsigned int cb )
-{
-  void *pRet = theFastHeap.New ((size_t)cb) ;
-  return pRet;
-}
-
-void operator delete(void *pUserData )
-{
-  theFastHeap.Delete (pUserData) ;
-}
-#endif
-
-#if 0
-extern "C" void * hdmalloc (size_t sz) ;
-extern "C" void hdfree (void * ptr) ;
-extern "C" void hdmalloc_stats (void) ;
-void * operator new( unsigned int cb )
-{
-  void *pRet = hdmalloc((size_t)cb) ;
-  return pRet;
-}
-
-void operator delete(void *pUserData )
-{
-  hdfree(pUserData) ;
-}
 #endif
 
 
@@ -0,0 +1,145 @@
+/**
+ *
+ * lifetimes imitates a server that handles requests in bursts. Each
+ * burst allocates many scratch buffers, each of which dies once
+ * SCRATCH_WINDOW more have been allocated, and now and then a record
+ * that outlives it by many bursts. Once the last scratch buffers are
+ * freed, the burst ends by allocating and freeing LARGE_COUNT large
+ * buffers. Scratch buffers and records come from two different call
+ * sites, so an allocator that predicts lifetimes from allocation sites
+ * (see LIFETIME in the Makefile) can tell them apart. The records kept
+ * are replaced oldest first. The benchmark reports the time taken and the bytes live
+ * at the end; the heap size that end_program reports shows whether the
+ * memory of the scratch buffers could be reused for the large buffers,
+ * or was pinned by the records left among it.
+ *
+ * Try the following, with and without LIFETIME=1:
+ *
+ *  lifetimes 10000 20000 50
+ *  lifetimes 20000 100000 20
+ *
+ *  Written for Fall 2012 by 6.172 Staff
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "timer.h"
+
+#include "../wrapper.cpp"
+
+// Scratch buffers and records have sizes in [MINIMUM_SIZE, MINIMUM_SIZE + SIZE_RANGE)
+#define MINIMUM_SIZE 32
+#define SIZE_RANGE 480
+
+// A burst allocates a record after every RECORD_INTERVAL scratch buffers
+#define RECORD_INTERVAL 64
+
+// A scratch buffer is freed once this many more have been allocated
+#define SCRATCH_WINDOW 256
+
+// The number and size of the large buffers that end a burst
+#define LARGE_COUNT 16
+#define LARGE_SIZE (64 * 1024)
+
+// Helper method that allocates a scratch buffer. Kept out of line so that it stays a call site of its own.
+static __attribute__((noinline)) void * allocateScratch(size_t size) {
+  return CUSTOM_MALLOC(size);
+}
+
+// Helper method that allocates a record. Kept out of line so that it stays a call site of its own.
+static __attribute__((noinline)) void * allocateRecord(size_t size) {
+  return CUSTOM_MALLOC(size);
+}
+
+// Helper method that allocates a large buffer. Kept out of line so that it stays a call site of its own.
+static __attribute__((noinline)) void * allocateLarge(size_t size) {
+  return CUSTOM_MALLOC(size);
+}
+
+
+int main (int argc, char * argv[])
+{
+  int nrecords;
+  int nscratch;
+  int bursts;
+
+  if (argc > 3) {
+    nrecords = atoi(argv[1]);
+    nscratch = atoi(argv[2]);
+    bursts = atoi(argv[3]);
+  } else {
+    fprintf (stderr, "Usage: %s records scratch bursts\n", argv[0]);
+    return 1;
+  }
+
+  void ** records = new void*[nrecords];
+  size_t * recordSizes = new size_t[nrecords];
+  void * scratch[SCRATCH_WINDOW];
+  void * large[LARGE_COUNT];
+  for (int i = 0; i < nrecords; i++) {
+    records[i] = NULL;
+    recordSizes[i] = 0;
+  }
+  for (int i = 0; i < SCRATCH_WINDOW; i++) {
+    scratch[i] = NULL;
+  }
+  int nextRecord = 0;
+  unsigned int seed = 1;
+  HL::Timer t;
+
+  t.start();
+  for (int b = 0; b < bursts; b++) {
+    for (int i = 0; i < nscratch; i++) {
+      int slot = i % SCRATCH_WINDOW;
+      if (scratch[slot]) {
+        CUSTOM_FREE(scratch[slot]);
+      }
+      seed = seed * 1103515245 + 12345;
+      size_t size = MINIMUM_SIZE + (seed >> 16) % SIZE_RANGE;
+      scratch[slot] = allocateScratch(size);
+      ((char *) scratch[slot])[0] = (char) i;
+      if (i % RECORD_INTERVAL == RECORD_INTERVAL - 1) {
+        if (records[nextRecord]) {
+          CUSTOM_FREE(records[nextRecord]);
+        }
+        seed = seed * 1103515245 + 12345;
+        recordSizes[nextRecord] = MINIMUM_SIZE + (seed >> 16) % SIZE_RANGE;
+        records[nextRecord] = allocateRecord(recordSizes[nextRecord]);
+        ((char *) records[nextRecord])[0] = (char) b;
+        nextRecord = (nextRecord + 1) % nrecords;
+      }
+    }
+    for (int i = 0; i < SCRATCH_WINDOW; i++) {
+      if (scratch[i]) {
+        CUSTOM_FREE(scratch[i]);
+        scratch[i] = NULL;
+      }
+    }
+    for (int i = 0; i < LARGE_COUNT; i++) {
+      large[i] = allocateLarge(LARGE_SIZE);
+      ((char *) large[i])[0] = (char) i;
+    }
+    for (int i = 0; i < LARGE_COUNT; i++) {
+      CUSTOM_FREE(large[i]);
+    }
+  }
+  t.stop();
+
+  size_t liveBytes = 0;
+  for (int i = 0; i < nrecords; i++) {
+    liveBytes += recordSizes[i];
+  }
+  printf ("Time elapsed = %f seconds, %lu bytes live in records\n", (double) t, (unsigned long) liveBytes);
+
+  for (int i = 0; i < nrecords; i++) {
+    if (records[i]) {
+      CUSTOM_FREE(records[i]);
+    }
+  }
+  delete [] records;
+  delete [] recordSizes;
+  end_program();
+  return 0;
+}
@@ -0,0 +1,161 @@
+/**
+ *
+ * locality measures how the placement of blocks affects the programs that
+ * use them. It first fragments the heap by allocating filler objects of
+ * random sizes and freeing a random half of them, then builds linked lists
+ * one node after another, traverses them, and finally frees and rebuilds
+ * each list in turn. It reports the time each phase took, and how often
+ * successive nodes of a list ended up next to each other or on the same
+ * page.
+ *
+ * Try the following, with each bin order of the custom allocator (see
+ * BINORDER in the Makefile):
+ *
+ *  locality 100 1000 100
+ *  locality 1000 100 100
+ *
+ *  Written for Fall 2012 by 6.172 Staff
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "timer.h"
+
+#include "../wrapper.cpp"
+
+// A node of a linked list. Nodes are NODE_SIZE bytes.
+struct Node {
+  Node * next;
+  long key;
+};
+
+#define NODE_SIZE 48
+
+// Successive nodes at most this far apart count as adjacent
+#define ADJACENT_DISTANCE 128
+
+// Helper method that builds a list of the given length, allocating its nodes in order
+static Node * buildList(int length, long firstKey) {
+  Node * head = NULL;
+  Node ** tail = &head;
+  for (int i = 0; i < length; i++) {
+    Node * node = (Node *) CUSTOM_MALLOC(NODE_SIZE);
+    node->key = firstKey + i;
+    node->next = NULL;
+    *tail = node;
+    tail = &(node->next);
+  }
+  return head;
+}
+
+// Helper method that frees every node of a list
+static void freeList(Node * head) {
+  while (head) {
+    Node * next = head->next;
+    CUSTOM_FREE(head);
+    head = next;
+  }
+}
+
+// Helper method that returns the sum of the keys of a list
+static long traverseList(Node * head) {
+  long sum = 0;
+  for (Node * node = head; node; node = node->next) {
+    sum += node->key;
+  }
+  return sum;
+}
+
+
+int main (int argc, char * argv[])
+{
+  int nlists;
+  int length;
+  int rounds;
+
+  if (argc > 3) {
+    nlists = atoi(argv[1]);
+    length = atoi(argv[2]);
+    rounds = atoi(argv[3]);
+  } else {
+    fprintf (stderr, "Usage: %s lists length rounds\n", argv[0]);
+    return 1;
+  }
+
+  // Fragment the heap: keep a random half of as many filler objects as there will be nodes
+  int nfillers = nlists * length;
+  void ** fillers = new void*[nfillers];
+  unsigned int seed = 1;
+  for (int i = 0; i < nfillers; i++) {
+    seed = seed * 1103515245 + 12345;
+    fillers[i] = CUSTOM_MALLOC(16 + (seed >> 16) % 112);
+  }
+  for (int i = 0; i < nfillers; i++) {
+    seed = seed * 1103515245 + 12345;
+    if ((seed >> 16) & 1) {
+      CUSTOM_FREE(fillers[i]);
+      fillers[i] = NULL;
+    }
+  }
+
+  Node ** lists = new Node*[nlists];
+  HL::Timer build, traverse, recycle;
+  long sum = 0;
+
+  build.start();
+  for (int i = 0; i < nlists; i++) {
+    lists[i] = buildList(length, (long) i * length);
+  }
+  build.stop();
+
+  traverse.start();
+  for (int r = 0; r < rounds; r++) {
+    for (int i = 0; i < nlists; i++) {
+      sum += traverseList(lists[i]);
+    }
+  }
+  traverse.stop();
+
+  long adjacent = 0;
+  long samePage = 0;
+  long pairs = 0;
+  for (int i = 0; i < nlists; i++) {
+    for (Node * node = lists[i]; node && node->next; node = node->next) {
+      long distance = (char *) node->next - (char *) node;
+      adjacent += (distance <= ADJACENT_DISTANCE && distance >= -ADJACENT_DISTANCE);
+      samePage += (((size_t) node >> 12) == ((size_t) node->next >> 12));
+      pairs++;
+    }
+  }
+
+  // Free and rebuild each list in turn, so that its nodes can reuse the blocks that were just freed
+  recycle.start();
+  for (int r = 0; r < rounds; r++) {
+    for (int i = 0; i < nlists; i++) {
+      freeList(lists[i]);
+      lists[i] = buildList(length, (long) r * i);
+      sum += traverseList(lists[i]);
+    }
+  }
+  recycle.stop();
+
+  for (int i = 0; i < nlists; i++) {
+    freeList(lists[i]);
+  }
+  for (int i = 0; i < nfillers; i++) {
+    if (fillers[i]) {
+      CUSTOM_FREE(fillers[i]);
+    }
+  }
+  delete [] lists;
+  delete [] fillers;
+
+  printf ("Build: %f seconds, traverse: %f seconds, recycle: %f seconds (checksum %ld)\n",
+          (double) build, (double) traverse, (double) recycle, sum);
+  printf ("Successive nodes: %.1f%% adjacent, %.1f%% on the same page\n",
+          pairs ? 100.0 * adjacent / pairs : 0.0, pairs ? 100.0 * samePage / pairs : 0.0);
+  end_program();
+  return 0;
+}
@@ -0,0 +1,139 @@
+/**
+ *
+ * object-pool compares my::object_pool against CUSTOM_MALLOC for a hot,
+ * fixed-size object that is allocated and freed in batches.
+ *
+ * Try the following (on a P-processor machine):
+ *
+ *  object-pool 1 10000 100
+ *  object-pool P 10000 100
+ *
+ *  Written for Fall 2012 by 6.172 Staff
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fred.h"
+#include "cpuinfo.h"
+#include "timer.h"
+
+#include "../wrapper.cpp"
+#include "../object_pool.h"
+
+// A typical hot object: a small node with a key, a value and two links
+struct HotObject {
+  HotObject * left;
+  HotObject * right;
+  long key;
+  long value;
+  int flags;
+};
+
+// This class just holds arguments to each thread.
+class workerArg {
+public:
+  workerArg (int iterations, int batch, bool usePool)
+    : _iterations (iterations),
+      _batch (batch),
+      _usePool (usePool)
+  {}
+
+  int _iterations;
+  int _batch;
+  bool _usePool;
+};
+
+
+#if defined(_WIN32)
+extern "C" void worker (void * arg)
+#else
+extern "C" void * worker (void * arg)
+#endif
+{
+  // Repeatedly allocate a batch of objects, write to each of them, then free them all.
+  workerArg * w = (workerArg *) arg;
+  HotObject ** objects = new HotObject*[w->_batch];
+
+  for (int i = 0; i < w->_iterations; i++) {
+    for (int j = 0; j < w->_batch; j++) {
+      if (w->_usePool) {
+        objects[j] = my::object_pool<HotObject>::allocate();
+      } else {
+        objects[j] = (HotObject *) CUSTOM_MALLOC(sizeof(HotObject));
+      }
+      objects[j]->key = j;
+      objects[j]->value = i;
+    }
+    for (int j = 0; j < w->_batch; j++) {
+      if (w->_usePool) {
+        my::object_pool<HotObject>::deallocate(objects[j]);
+      } else {
+        CUSTOM_FREE(objects[j]);
+      }
+    }
+  }
+
+  // Only the CUSTOM_MALLOC phase logs anything to validate. Its threads may reuse the IDs of the pool phase's,
+  // so ending the pool phase's threads as well would leave two logs under one name.
+  if (!w->_usePool) {
+    end_thread();
+  }
+  delete [] objects;
+  delete w;
+
+#if !defined(_WIN32)
+  return NULL;
+#endif
+}
+
+// Runs the workload on nthreads threads and returns the elapsed time in seconds
+static double run (int nthreads, int iterations, int batch, bool usePool)
+{
+  HL::Fred * threads = new HL::Fred[nthreads];
+  HL::Timer t;
+  t.start();
+
+  for (int i = 0; i < nthreads; i++) {
+    workerArg * w = new workerArg (iterations, batch, usePool);
+    threads[i].create (&worker, (void *) w);
+  }
+  for (int i = 0; i < nthreads; i++) {
+    threads[i].join();
+  }
+  t.stop();
+
+  delete [] threads;
+  return (double) t;
+}
+
+
+int main (int argc, char * argv[])
+{
+  int nthreads;
+  int iterations;
+  int batch;
+
+  if (argc > 3) {
+    nthreads = atoi(argv[1]);
+    iterations = atoi(argv[2]);
+    batch = atoi(argv[3]);
+  } else {
+    fprintf (stderr, "Usage: %s nthreads iterations batch\n", argv[0]);
+    return 1;
+  }
+
+  HL::Fred::setConcurrency (HL::CPUInfo::getNumProcessors());
+
+  // The pool refills its slabs from my::allocator, which must be set up even in the libc build.
+  my_malloc_init();
+
+  double poolTime = run (nthreads, iterations, batch, true);
+  double mallocTime = run (nthreads, iterations, batch, false);
+
+  printf ("object_pool: time elapsed = %f seconds.\n", poolTime);
+  printf ("CUSTOM_MALLOC: time elapsed = %f seconds.\n", mallocTime);
+  end_program();
+  return 0;
+}
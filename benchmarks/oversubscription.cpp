@@ -0,0 +1,153 @@
+/**
+ *
+ * oversubscription runs more threads than there are processors, each
+ * allocating small objects and handing half of them to other threads to
+ * free, so that the allocator's locks are contended while their holders
+ * may be preempted. It reports the time taken, the context switches the
+ * process made and, for the custom allocator, the counters of its locks.
+ *
+ * Try the following (on a P-processor machine):
+ *
+ *  oversubscription P 20000 64
+ *  oversubscription 4P 20000 64
+ *  oversubscription 16P 20000 64
+ *
+ *  Written for Fall 2012 by 6.172 Staff
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include "fred.h"
+#include "cpuinfo.h"
+#include "timer.h"
+
+#include "../wrapper.cpp"
+
+// A mailbox through which threads hand objects to each other. Each one sits on a cache line of its own.
+struct Mailbox {
+  void * volatile object;
+  char padding[64 - sizeof(void *)];
+};
+
+// This class just holds arguments to each thread.
+class workerArg {
+public:
+  workerArg (int id, int nthreads, int iterations, int batch, Mailbox * mailboxes)
+    : _id (id),
+      _nthreads (nthreads),
+      _iterations (iterations),
+      _batch (batch),
+      _mailboxes (mailboxes)
+  {}
+
+  int _id;
+  int _nthreads;
+  int _iterations;
+  int _batch;
+  Mailbox * _mailboxes;
+};
+
+
+#if defined(_WIN32)
+extern "C" void worker (void * arg)
+#else
+extern "C" void * worker (void * arg)
+#endif
+{
+  // Allocate a batch of objects, free half of them here and leave the other half in random mailboxes,
+  // freeing whatever some other thread left in each of them before.
+  workerArg * w = (workerArg *) arg;
+  void ** objects = new void*[w->_batch];
+  unsigned int seed = w->_id;
+
+  for (int i = 0; i < w->_iterations; i++) {
+    for (int j = 0; j < w->_batch; j++) {
+      seed = seed * 1103515245 + 12345;
+      objects[j] = CUSTOM_MALLOC(16 + (seed >> 16) % 112);
+      *(int *) objects[j] = j;
+    }
+    for (int j = 0; j < w->_batch; j++) {
+      if (j % 2) {
+        seed = seed * 1103515245 + 12345;
+        Mailbox * mailbox = &w->_mailboxes[(seed >> 16) % w->_nthreads];
+        void * previous = __sync_lock_test_and_set(&mailbox->object, objects[j]);
+        if (previous) {
+          CUSTOM_FREE(previous);
+        }
+      } else {
+        CUSTOM_FREE(objects[j]);
+      }
+    }
+  }
+
+  delete [] objects;
+  delete w;
+  end_thread();
+
+#if !defined(_WIN32)
+  return NULL;
+#endif
+}
+
+
+int main (int argc, char * argv[])
+{
+  int nthreads;
+  int iterations;
+  int batch;
+
+  if (argc > 3) {
+    nthreads = atoi(argv[1]);
+    iterations = atoi(argv[2]);
+    batch = atoi(argv[3]);
+  } else {
+    fprintf (stderr, "Usage: %s nthreads iterations batch\n", argv[0]);
+    return 1;
+  }
+
+  HL::Fred::setConcurrency (HL::CPUInfo::getNumProcessors());
+
+  Mailbox * mailboxes = new Mailbox[nthreads];
+  for (int i = 0; i < nthreads; i++) {
+    mailboxes[i].object = NULL;
+  }
+  HL::Fred * threads = new HL::Fred[nthreads];
+  struct rusage before, after;
+  getrusage (RUSAGE_SELF, &before);
+  HL::Timer t;
+  t.start();
+
+  for (int i = 0; i < nthreads; i++) {
+    workerArg * w = new workerArg (i, nthreads, iterations, batch, mailboxes);
+    threads[i].create (&worker, (void *) w);
+  }
+  for (int i = 0; i < nthreads; i++) {
+    threads[i].join();
+  }
+  t.stop();
+  getrusage (RUSAGE_SELF, &after);
+
+  for (int i = 0; i < nthreads; i++) {
+    if (mailboxes[i].object) {
+      CUSTOM_FREE(mailboxes[i].object);
+    }
+  }
+  delete [] threads;
+  delete [] mailboxes;
+
+  printf ("%d threads on %d processors: time elapsed = %f seconds.\n",
+          nthreads, HL::CPUInfo::getNumProcessors(), (double) t);
+  printf ("Context switches: %ld voluntary, %ld involuntary\n",
+          after.ru_nvcsw - before.ru_nvcsw, after.ru_nivcsw - before.ru_nivcsw);
+#ifdef MYMALLOC
+  my::lock_stats stats;
+  my::allocator::get_lock_stats (&stats);
+  printf ("Lock acquisitions: %llu, contended: %llu, parked: %llu\n",
+          stats.acquisitions, stats.contentions, stats.parks);
+#endif
+  end_program();
+  return 0;
+}
@@ -0,0 +1,163 @@
+/**
+ *
+ * producer-consumer runs pairs of threads connected by a bounded queue:
+ * the producer of each pair allocates small objects and passes them on,
+ * and the consumer frees them, so that every object is freed by a
+ * different thread than the one that allocated it. It reports the time
+ * taken and, for the custom allocator, the counters of its locks.
+ *
+ * Try the following (on a P-processor machine):
+ *
+ *  producer-consumer 1 1000000 256
+ *  producer-consumer P/2 1000000 256
+ *
+ *  Written for Fall 2012 by 6.172 Staff
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+
+#include "fred.h"
+#include "cpuinfo.h"
+#include "timer.h"
+
+#include "../wrapper.cpp"
+
+// A bounded single-producer, single-consumer queue of objects. The two ends sit on cache lines of their own.
+struct Queue {
+  volatile unsigned long head;
+  char padding1[64 - sizeof(unsigned long)];
+  volatile unsigned long tail;
+  char padding2[64 - sizeof(unsigned long)];
+  void * volatile * slots;
+  int capacity;
+};
+
+// This class just holds arguments to each thread.
+class workerArg {
+public:
+  workerArg (Queue * queue, int objects)
+    : _queue (queue),
+      _objects (objects)
+  {}
+
+  Queue * _queue;
+  int _objects;
+};
+
+
+#if defined(_WIN32)
+extern "C" void producer (void * arg)
+#else
+extern "C" void * producer (void * arg)
+#endif
+{
+  workerArg * w = (workerArg *) arg;
+  Queue * q = w->_queue;
+  unsigned int seed = (unsigned int) (size_t) q;
+
+  for (int i = 0; i < w->_objects; i++) {
+    seed = seed * 1103515245 + 12345;
+    void * object = CUSTOM_MALLOC(16 + (seed >> 16) % 112);
+    *(int *) object = i;
+    while (q->tail - q->head == (unsigned long) q->capacity) {
+      sched_yield();
+    }
+    q->slots[q->tail % q->capacity] = object;
+    __sync_synchronize();
+    q->tail = q->tail + 1;
+  }
+
+  delete w;
+  end_thread();
+
+#if !defined(_WIN32)
+  return NULL;
+#endif
+}
+
+
+#if defined(_WIN32)
+extern "C" void consumer (void * arg)
+#else
+extern "C" void * consumer (void * arg)
+#endif
+{
+  workerArg * w = (workerArg *) arg;
+  Queue * q = w->_queue;
+
+  for (int i = 0; i < w->_objects; i++) {
+    while (q->head == q->tail) {
+      sched_yield();
+    }
+    __sync_synchronize();
+    void * object = q->slots[q->head % q->capacity];
+    q->head = q->head + 1;
+    CUSTOM_FREE(object);
+  }
+
+  delete w;
+  end_thread();
+
+#if !defined(_WIN32)
+  return NULL;
+#endif
+}
+
+
+int main (int argc, char * argv[])
+{
+  int npairs;
+  int objects;
+  int capacity;
+
+  if (argc > 3) {
+    npairs = atoi(argv[1]);
+    objects = atoi(argv[2]);
+    capacity = atoi(argv[3]);
+  } else {
+    fprintf (stderr, "Usage: %s npairs objects capacity\n", argv[0]);
+    return 1;
+  }
+
+  HL::Fred::setConcurrency (HL::CPUInfo::getNumProcessors());
+
+  Queue * queues = new Queue[npairs];
+  for (int i = 0; i < npairs; i++) {
+    queues[i].head = 0;
+    queues[i].tail = 0;
+    queues[i].slots = new void * volatile[capacity];
+    queues[i].capacity = capacity;
+  }
+  HL::Fred * threads = new HL::Fred[2 * npairs];
+  HL::Timer t;
+  t.start();
+
+  for (int i = 0; i < npairs; i++) {
+    threads[2 * i].create (&producer, (void *) new workerArg (&queues[i], objects));
+    threads[2 * i + 1].create (&consumer, (void *) new workerArg (&queues[i], objects));
+  }
+  for (int i = 0; i < 2 * npairs; i++) {
+    threads[i].join();
+  }
+  t.stop();
+
+  for (int i = 0; i < npairs; i++) {
+    delete [] queues[i].slots;
+  }
+  delete [] threads;
+  delete [] queues;
+
+  printf ("%d pairs on %d processors: time elapsed = %f seconds.\n",
+          npairs, HL::CPUInfo::getNumProcessors(), (double) t);
+#ifdef MYMALLOC
+  my::lock_stats stats;
+  my::allocator::get_lock_stats (&stats);
+  printf ("Lock acquisitions: %llu, contended: %llu, parked: %llu\n",
+          stats.acquisitions, stats.contentions, stats.parks);
+#endif
+  end_program();
+  return 0;
+}
@@ -52,17 +52,6 @@ typedef bool moolean;
 
 SMP_HEAP theFastHeap (1024 * 1024, true, true, true);
 
-void * operator new( unsigned int cb )
-{
-  void *pRet = theFastHeap.New ((size_t)cb) ;
-  return pRet;
-}
-
-void operator delete(void *pUserData )
-{
-  theFastHeap.Delete (pUserData) ;
-}
-
 #define malloc(s) theFastHeap.New(s)
 #define free(p) theFastHeap.Delete(p)
 
@@ -0,0 +1,355 @@
+/**
+ * Copyright (c) 2012 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+#include <limits.h>
+#include <cstdlib>
+#include <cstring>
+#include "./allocator_interface.h"
+#include "./memlib.h"
+
+// buddy_allocator.cpp - A binary buddy allocator, for comparison with the main allocator in mdriver.
+//
+// The heap is a single block of 2^heapOrder bytes that doubles whenever no free block is large enough. Every block
+// is a power of two in size and sits at an offset from the start of the heap that is a multiple of its size, so the
+// buddy it was split from lies at the offset with the block's size bit flipped. Which granules start a free block is
+// kept in a bitmap, so that free can tell whether a buddy is free without a header flag, and the free blocks of each
+// order are kept in a doubly linked list so that a buddy can be taken out of its list when the two are merged.
+
+// All blocks must have a specified minimum alignment.
+#ifndef ALIGNMENT
+#define ALIGNMENT 8
+#endif
+
+// Rounds up to the nearest multiple of ALIGNMENT.
+#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(ALIGNMENT-1))
+
+// The header that precedes the payload of every block
+#define BUDDY_HEADER_SIZE (ALIGN(sizeof(uint32_t)))
+
+// Blocks are at least 16 bytes, which is also the granule that the bitmap and the free lists count in
+#define BUDDY_MIN_ORDER 4
+
+// mem_sbrk takes an int, so the heap can double up to 2 GB
+#define BUDDY_MAX_ORDER 31
+
+#define BUDDY_MAX_GRANULES ((size_t) 1 << (BUDDY_MAX_ORDER - BUDDY_MIN_ORDER))
+
+// Marks the end of a free list
+#define BUDDY_NIL UINT32_MAX
+
+namespace my {
+
+// A block of the buddy heap. Only the order is kept while the block is allocated; the links overlap its payload.
+struct BuddyBlock {
+  uint32_t order; // log2 of the size of the entire block including the header
+  uint32_t unused;
+  uint32_t nextFreeBlock; // granule of the next free block of the same order
+  uint32_t previousFreeBlock; // granule of the previous free block of the same order
+};
+
+static_assert(BUDDY_HEADER_SIZE + 2 * sizeof(uint32_t) <= ((size_t) 1 << BUDDY_MIN_ORDER),
+              "a free block of the smallest order must hold its header and its links");
+
+// The start of the heap, and log2 of its size (-1 while the heap is empty)
+static char * heapBase;
+static int heapOrder = -1;
+
+// The granule of the first free block of each order, and a mask of the orders whose lists are not empty
+static uint32_t freeLists[BUDDY_MAX_ORDER + 1];
+static uint64_t nonEmptyOrders;
+
+// One bit per granule of the heap, set when a free block starts at that granule
+static uint64_t freeBlockBitmap[BUDDY_MAX_GRANULES / 64];
+
+// Helper method that returns the number of granules in the heap
+static inline size_t getHeapGranules() {
+  return heapOrder < 0 ? 0 : (size_t) 1 << (heapOrder - BUDDY_MIN_ORDER);
+}
+
+// Helper method that returns the block that starts at the given granule
+static inline BuddyBlock * getBlock(uint32_t granule) {
+  return (BuddyBlock *) (heapBase + ((size_t) granule << BUDDY_MIN_ORDER));
+}
+
+// Helper method that returns the granule that the given block starts at
+static inline uint32_t getGranule(BuddyBlock * bb) {
+  return (uint32_t) (((char *) bb - heapBase) >> BUDDY_MIN_ORDER);
+}
+
+// Helper method that returns the smallest order of a block that holds size bytes of payload
+static inline int getOrder(size_t size) {
+  size_t needed = size + BUDDY_HEADER_SIZE;
+  int order = 64 - __builtin_clzl(needed - 1);
+  return order < BUDDY_MIN_ORDER ? BUDDY_MIN_ORDER : order;
+}
+
+// Helper method that returns whether a free block starts at the given granule
+static inline bool isFreeBlock(uint32_t granule) {
+  return (freeBlockBitmap[granule >> 6] >> (granule & 63)) & 1;
+}
+
+// Helper method that adds the block at the given granule to the free list of the given order
+static inline void addBlockToFreeList(uint32_t granule, int order) {
+  BuddyBlock * bb = getBlock(granule);
+  bb->order = order;
+  bb->nextFreeBlock = freeLists[order];
+  bb->previousFreeBlock = BUDDY_NIL;
+  if (freeLists[order] != BUDDY_NIL) {
+    getBlock(freeLists[order])->previousFreeBlock = granule;
+  }
+  freeLists[order] = granule;
+  nonEmptyOrders |= (uint64_t) 1 << order;
+  freeBlockBitmap[granule >> 6] |= (uint64_t) 1 << (granule & 63);
+}
+
+// Helper method that removes the block at the given granule from its free list
+static inline void removeBlockFromFreeList(uint32_t granule) {
+  BuddyBlock * bb = getBlock(granule);
+  if (bb->previousFreeBlock != BUDDY_NIL) {
+    getBlock(bb->previousFreeBlock)->nextFreeBlock = bb->nextFreeBlock;
+  } else {
+    freeLists[bb->order] = bb->nextFreeBlock;
+    if (bb->nextFreeBlock == BUDDY_NIL) {
+      nonEmptyOrders &= ~((uint64_t) 1 << bb->order);
+    }
+  }
+  if (bb->nextFreeBlock != BUDDY_NIL) {
+    getBlock(bb->nextFreeBlock)->previousFreeBlock = bb->previousFreeBlock;
+  }
+  freeBlockBitmap[granule >> 6] &= ~((uint64_t) 1 << (granule & 63));
+}
+
+// Helper method that frees the block at the given granule, merging it with its buddy for as long as the buddy is
+// a free block of the same order
+static inline void releaseBlock(uint32_t granule, int order) {
+  while (order < heapOrder) {
+    uint32_t buddy = granule ^ ((uint32_t) 1 << (order - BUDDY_MIN_ORDER));
+    if (!isFreeBlock(buddy) || getBlock(buddy)->order != (uint32_t) order) {
+      break;
+    }
+    removeBlockFromFreeList(buddy);
+    granule &= buddy;
+    order++;
+  }
+  addBlockToFreeList(granule, order);
+}
+
+// Helper method that extends the heap by the given number of bytes. Returns NULL if it cannot be extended.
+static inline char * extendHeap(size_t size) {
+  if (size > INT_MAX) {
+    return NULL;
+  }
+  void * p = mem_sbrk((int) size);
+  if (p == (void *) -1) {
+    return NULL;
+  }
+  assert(heapOrder < 0 || (char *) p == heapBase + ((size_t) 1 << heapOrder));
+  return (char *) p;
+}
+
+// Helper method that doubles the heap, freeing its new upper half. Returns false if the heap cannot grow.
+static inline bool growHeap() {
+  if (heapOrder >= BUDDY_MAX_ORDER || !extendHeap((size_t) 1 << heapOrder)) {
+    return false;
+  }
+  uint32_t granule = (uint32_t) getHeapGranules();
+  heapOrder++;
+  releaseBlock(granule, heapOrder - 1);
+  return true;
+}
+
+// buddy_init - Empties the heap.
+int buddy_allocator::init() {
+  memset(freeBlockBitmap, 0, (getHeapGranules() + 63) / 64 * sizeof(uint64_t));
+  for (int i = 0; i <= BUDDY_MAX_ORDER; i++) {
+    freeLists[i] = BUDDY_NIL;
+  }
+  nonEmptyOrders = 0;
+  heapBase = NULL;
+  heapOrder = -1;
+  return 0;
+}
+
+// buddy_check - Walks the heap and the free lists, and checks that every block is aligned to its size, that no
+// two free buddies were left unmerged and that the free lists hold exactly the blocks marked free in the bitmap.
+int buddy_allocator::check() {
+  size_t freeBlocks = 0;
+  for (uint32_t granule = 0; granule < getHeapGranules(); ) {
+    BuddyBlock * bb = getBlock(granule);
+    if (bb->order < BUDDY_MIN_ORDER || (int) bb->order > heapOrder) {
+      printf("Block at granule %u has order %u\n", granule, bb->order);
+      return -1;
+    }
+    uint32_t granules = (uint32_t) 1 << (bb->order - BUDDY_MIN_ORDER);
+    if (granule & (granules - 1)) {
+      printf("Block at granule %u is not aligned to its size\n", granule);
+      return -1;
+    }
+    if (isFreeBlock(granule)) {
+      freeBlocks++;
+      uint32_t buddy = granule ^ granules;
+      if ((int) bb->order < heapOrder && isFreeBlock(buddy) && getBlock(buddy)->order == bb->order) {
+        printf("Free block at granule %u and its buddy were not merged\n", granule);
+        return -1;
+      }
+    }
+    granule += granules;
+  }
+
+  size_t listedBlocks = 0;
+  for (int order = 0; order <= BUDDY_MAX_ORDER; order++) {
+    if (((nonEmptyOrders >> order) & 1) != (freeLists[order] != BUDDY_NIL)) {
+      printf("The mask of non-empty orders disagrees with free list %d\n", order);
+      return -1;
+    }
+    uint32_t previous = BUDDY_NIL;
+    for (uint32_t granule = freeLists[order]; granule != BUDDY_NIL; granule = getBlock(granule)->nextFreeBlock) {
+      BuddyBlock * bb = getBlock(granule);
+      if (!isFreeBlock(granule) || bb->order != (uint32_t) order || bb->previousFreeBlock != previous) {
+        printf("Free list %d contains a block at granule %u that is not linked as a free block of that order\n",
+               order, granule);
+        return -1;
+      }
+      previous = granule;
+      listedBlocks++;
+    }
+  }
+  if (listedBlocks != freeBlocks) {
+    printf("The free lists hold %zu blocks but the bitmap marks %zu\n", listedBlocks, freeBlocks);
+    return -1;
+  }
+  return 0;
+}
+
+// buddy_malloc - Takes the smallest free block that fits, doubling the heap until there is one, and splits it in
+// halves until it is the size that was asked for, freeing the upper halves.
+void * buddy_allocator::malloc(size_t size) {
+  int order = getOrder(size);
+  if (order >= BUDDY_MAX_ORDER) {
+    return NULL;
+  }
+  if (heapOrder < 0) {
+    heapBase = extendHeap((size_t) 1 << order);
+    if (!heapBase) {
+      return NULL;
+    }
+    heapOrder = order;
+    addBlockToFreeList(0, order);
+  }
+  while (!(nonEmptyOrders >> order)) {
+    if (!growHeap()) {
+      return NULL;
+    }
+  }
+
+  int blockOrder = __builtin_ctzl(nonEmptyOrders >> order) + order;
+  uint32_t granule = freeLists[blockOrder];
+  removeBlockFromFreeList(granule);
+  while (blockOrder > order) {
+    blockOrder--;
+    addBlockToFreeList(granule + ((uint32_t) 1 << (blockOrder - BUDDY_MIN_ORDER)), blockOrder);
+  }
+  BuddyBlock * bb = getBlock(granule);
+  bb->order = order;
+  return (char *) bb + BUDDY_HEADER_SIZE;
+}
+
+// buddy_free - Frees the block and merges it with its buddies.
+void buddy_allocator::free(void *ptr) {
+  if (!ptr) {
+    return;
+  }
+  BuddyBlock * bb = (BuddyBlock *) ((char *) ptr - BUDDY_HEADER_SIZE);
+  releaseBlock(getGranule(bb), bb->order);
+}
+
+// buddy_realloc - Shrinks the block in place by freeing its upper halves, or grows it in place when the buddies
+// above it are free (or the block is the whole heap, which is then extended), and otherwise moves it.
+void * buddy_allocator::realloc(void *ptr, size_t size) {
+  if (!ptr) {
+    return malloc(size);
+  }
+  BuddyBlock * bb = (BuddyBlock *) ((char *) ptr - BUDDY_HEADER_SIZE);
+  uint32_t granule = getGranule(bb);
+  int order = bb->order;
+  int newOrder = getOrder(size);
+
+  if (newOrder <= order) {
+    while (order > newOrder) {
+      // The upper half's buddy is the block itself, so there is nothing to merge it with
+      order--;
+      addBlockToFreeList(granule + ((uint32_t) 1 << (order - BUDDY_MIN_ORDER)), order);
+    }
+    bb->order = order;
+    return ptr;
+  }
+
+  if (newOrder < BUDDY_MAX_ORDER) {
+    // The block can grow in place if it is the lower half at every order up to the new one and each upper half is
+    // free; past the top of the heap, the block is the whole heap and the heap itself is extended.
+    int k;
+    for (k = order; k < newOrder && k < heapOrder; k++) {
+      uint32_t buddy = granule | ((uint32_t) 1 << (k - BUDDY_MIN_ORDER));
+      if (buddy == granule || !isFreeBlock(buddy) || getBlock(buddy)->order != (uint32_t) k) {
+        break;
+      }
+    }
+    if (k == newOrder || (k == heapOrder && granule == 0 &&
+                          extendHeap(((size_t) 1 << newOrder) - ((size_t) 1 << heapOrder)))) {
+      for (int i = order; i < k; i++) {
+        removeBlockFromFreeList(granule | ((uint32_t) 1 << (i - BUDDY_MIN_ORDER)));
+      }
+      if (newOrder > heapOrder) {
+        heapOrder = newOrder;
+      }
+      bb->order = newOrder;
+      return ptr;
+    }
+  }
+
+  void * newptr = malloc(size);
+  if (!newptr) {
+    return NULL;
+  }
+  memcpy(newptr, ptr, ((size_t) 1 << order) - BUDDY_HEADER_SIZE);
+  free(ptr);
+  return newptr;
+}
+
+// call mem_reset_brk.
+void buddy_allocator::reset_brk() {
+  mem_reset_brk();
+}
+
+// call mem_heap_lo
+void * buddy_allocator::heap_lo() {
+  return mem_heap_lo();
+}
+
+// call mem_heap_hi
+void * buddy_allocator::heap_hi() {
+  return mem_heap_hi();
+}
+};
@@ -58,12 +58,37 @@
 #define ALIGNMENT 8
 
 /*
- * Maximum heap size in bytes
+ * Maximum heap size in bytes. memlib only reserves this much address
+ * space; pages are committed as the heap grows. The MEMLIB_MAX_HEAP
+ * environment variable overrides it at run time.
  */
-#define MAX_HEAP (50*(1<<20))  /* 50 MB */
+#define MAX_HEAP ((size_t)16 << 30)  /* 16 GB */
+
+/*
+ * Granularity in bytes with which memlib commits pages as the brk advances
+ */
+#define MEM_COMMIT_CHUNK (64 * (1 << 10))  /* 64 KB */
+
+/*
+ * Size in bytes of a transparent huge page. With huge pages enabled, the
+ * heap reservation is aligned to it and memlib commits in these steps.
+ */
+#define MEM_HUGE_PAGE_SIZE (2 * (1 << 20))  /* 2 MB */
+
+/*
+ * The most NUMA nodes that memlib will place heap pages on
+ */
+#define MEM_MAX_NUMA_NODES 64
 
 #define MEM_ALLOWANCE (40 * (1 << 10)) /* 40 KB */
 
+/*
+ * Number of runs over each trace for the worst-case latency report
+ * (mdriver -L). The worst case of each kind of request is the smallest
+ * of its per-run worst cases, which filters out one-off interrupts.
+ */
+#define LATENCY_RUNS 3
+
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
@@ -11,6 +11,8 @@
  */
 
 #include "./mdriver.h"
+#include "./clock.h"
+#include "./perfctr.h"
 #include "./validator.h"
 
 /******************************
@@ -27,6 +29,10 @@ typedef struct {
 
   /* defined only for the student malloc package */
   double util;     /* space utilization for this trace (always 0 for libc) */
+  double tlb_misses;  /* dTLB misses in one timed run (-1 if not counted) */
+  double page_faults; /* page faults in one timed run (-1 if not counted) */
+  size_t committed; /* heap bytes committed once the trace has been evaluated */
+  double max_cycles[3]; /* worst-case cycles of one request of each traceop_type (-L only) */
 
   /* Note: secs and util are only defined if valid is true */
 } stats_t;
@@ -36,6 +42,7 @@ typedef struct {
  *******************/
 int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
+static int use_sites = 0; /* tag mm requests with allocation sites (set by -S) */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
 /* Directory where default tracefiles are found */
@@ -59,18 +66,28 @@ static void eval_libc_speed(trace_t *trace);
 
 /* Routines for evaluating correctnes, space utilization, and speed
    of the student's malloc package in mm.c */
+template <class Type>
 static double eval_mm_util(trace_t *trace, int tracenum);
+template <class Type>
 static void eval_mm_speed(trace_t *trace);
 template <class Type>
+static void eval_mm_counters(trace_t *trace, stats_t *stats);
+template <class Type>
+static void eval_mm_latency(trace_t *trace, stats_t *stats);
+template <class Type>
 static int eval_mm_check(Type *impl, trace_t *trace, int tracenum);
 
 /* Various helper routines */
 static void printresults(int n, char **tracefiles, stats_t *stats);
+static void printcounters(int n, stats_t *stats);
+static void printlatencies(int n, char **tracefiles, stats_t *stats);
 static void usage(void);
 
 my::allocator my_impl;
 my::libc_allocator libc_impl;
 my::bad_allocator bad_impl;
+my::buddy_allocator buddy_impl;
+my::tlsf_allocator tlsf_impl;
 
 /**************
  * Main routine
@@ -83,12 +100,18 @@ int main(int argc, char **argv) {
   trace_t *trace = NULL;     /* stores a single trace file in memory */
   stats_t *libc_stats = NULL;/* libc stats for each trace */
   stats_t *bad_stats = NULL; /* bad malloc stats for each trace */
+  stats_t *buddy_stats = NULL; /* buddy malloc stats for each trace */
+  stats_t *tlsf_stats = NULL; /* TLSF malloc stats for each trace */
   stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
 
   int run_libc = 0;    /* If set, run libc malloc (set by -l) */
   int run_bad = 0;     /* If set, run bad malloc (set by -b) */
+  int run_buddy = 0;   /* If set, run buddy malloc (set by -B) */
+  int run_tlsf = 0;    /* If set, run TLSF malloc (set by -T) */
+  int latency = 0;     /* If set, report worst-case latencies (set by -L) */
   int check_heap = 0;  /* If set, run the student heap checker (set by -c) */
   int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+  int hugepages = 0;   /* If set, lay the heap out on huge pages (set by -H) */
 
   /* temporaries used to compute the performance index */
   double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -97,7 +120,7 @@ int main(int argc, char **argv) {
   /*
    * Read and interpret the command line arguments
    */
-  while ((c = getopt(argc, argv, "f:t:hvVgalbc")) != EOF) {
+  while ((c = getopt(argc, argv, "f:t:hvVgalbBTLcHS")) != EOF) {
     switch (c) {
       case 'g': /* Generate summary info for the autograder */
         autograder = 1;
@@ -123,9 +146,24 @@ int main(int argc, char **argv) {
       case 'b': /* Run bad malloc to check the verifier. */
         run_bad = 1;
         break;
+      case 'B': /* Run buddy malloc to compare against */
+        run_buddy = 1;
+        break;
+      case 'T': /* Run TLSF malloc to compare against */
+        run_tlsf = 1;
+        break;
+      case 'L': /* Report the worst-case latency of each request */
+        latency = 1;
+        break;
       case 'c':
         check_heap = 1;
         break;
+      case 'H': /* Use the huge page heap layout */
+        hugepages = 1;
+        break;
+      case 'S': /* Tag mm requests with allocation sites */
+        use_sites = 1;
+        break;
       case 'v': /* Print per-trace performance breakdown */
         verbose = 1;
         break;
@@ -193,6 +231,9 @@ int main(int argc, char **argv) {
   }
 
   /* Initialize the simulated memory system in memlib.c */
+  if (hugepages) {
+    mem_set_hugepages(1);
+  }
   mem_init();
 
   /*
@@ -228,6 +269,110 @@ int main(int argc, char **argv) {
     }
   }
 
+  /*
+   * Optionally run and evaluate the buddy malloc package
+   */
+  if (run_buddy) {
+    if (verbose > 1) {
+      printf("\nTesting buddy malloc\n");
+    }
+
+    /* Allocate buddy stats array, with one stats_t struct per tracefile */
+    buddy_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+    if (buddy_stats == NULL) {
+      unix_error("buddy_stats calloc in main failed");
+    }
+
+    /* Evaluate the buddy malloc package using the K-best scheme */
+    for (i = 0; i < num_tracefiles; i++) {
+      trace = read_trace(tracedir, tracefiles[i]);
+      buddy_stats[i].ops = trace->num_ops;
+      if (verbose > 1) {
+        printf("Checking buddy malloc for correctness, ");
+      }
+      buddy_stats[i].valid = eval_mm_valid(&buddy_impl, trace, i);
+      if (check_heap) {
+        buddy_stats[i].checked = eval_mm_check(&buddy_impl, trace, i);
+      }
+      if (buddy_stats[i].valid) {
+        if (verbose > 1) {
+          printf("efficiency, ");
+        }
+        buddy_stats[i].util = eval_mm_util<my::buddy_allocator>(trace, i);
+        if (verbose > 1) {
+          printf("and performance.\n");
+        }
+        buddy_stats[i].secs = fsecs((void (*)(void *))eval_mm_speed<my::buddy_allocator>, trace);
+        if (latency) {
+          eval_mm_latency<my::buddy_allocator>(trace, &buddy_stats[i]);
+        }
+      }
+      free_trace(trace);
+    }
+
+    /* Display the buddy results in a compact table */
+    if (verbose) {
+      printf("\nResults for buddy malloc:\n");
+      printresults(num_tracefiles, tracefiles, buddy_stats);
+    }
+    if (latency) {
+      printf("\nWorst-case latencies for buddy malloc:\n");
+      printlatencies(num_tracefiles, tracefiles, buddy_stats);
+    }
+  }
+
+  /*
+   * Optionally run and evaluate the TLSF malloc package
+   */
+  if (run_tlsf) {
+    if (verbose > 1) {
+      printf("\nTesting TLSF malloc\n");
+    }
+
+    /* Allocate TLSF stats array, with one stats_t struct per tracefile */
+    tlsf_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+    if (tlsf_stats == NULL) {
+      unix_error("tlsf_stats calloc in main failed");
+    }
+
+    /* Evaluate the TLSF malloc package using the K-best scheme */
+    for (i = 0; i < num_tracefiles; i++) {
+      trace = read_trace(tracedir, tracefiles[i]);
+      tlsf_stats[i].ops = trace->num_ops;
+      if (verbose > 1) {
+        printf("Checking TLSF malloc for correctness, ");
+      }
+      tlsf_stats[i].valid = eval_mm_valid(&tlsf_impl, trace, i);
+      if (check_heap) {
+        tlsf_stats[i].checked = eval_mm_check(&tlsf_impl, trace, i);
+      }
+      if (tlsf_stats[i].valid) {
+        if (verbose > 1) {
+          printf("efficiency, ");
+        }
+        tlsf_stats[i].util = eval_mm_util<my::tlsf_allocator>(trace, i);
+        if (verbose > 1) {
+          printf("and performance.\n");
+        }
+        tlsf_stats[i].secs = fsecs((void (*)(void *))eval_mm_speed<my::tlsf_allocator>, trace);
+        if (latency) {
+          eval_mm_latency<my::tlsf_allocator>(trace, &tlsf_stats[i]);
+        }
+      }
+      free_trace(trace);
+    }
+
+    /* Display the TLSF results in a compact table */
+    if (verbose) {
+      printf("\nResults for TLSF malloc:\n");
+      printresults(num_tracefiles, tracefiles, tlsf_stats);
+    }
+    if (latency) {
+      printf("\nWorst-case latencies for TLSF malloc:\n");
+      printlatencies(num_tracefiles, tracefiles, tlsf_stats);
+    }
+  }
+
   /*
    * Always run and evaluate the student's mm package
    */
@@ -256,12 +401,22 @@ int main(int argc, char **argv) {
       if (verbose > 1) {
         printf("efficiency, ");
       }
-      mm_stats[i].util = eval_mm_util(trace, i);
+      mm_stats[i].util = eval_mm_util<my::allocator>(trace, i);
       if (verbose > 1) {
         printf("and performance.\n");
       }
-      mm_stats[i].secs = fsecs((void (*)(void *))eval_mm_speed, trace);
+      mm_stats[i].secs = fsecs((void (*)(void *))eval_mm_speed<my::allocator>, trace);
+      if (verbose) {
+        eval_mm_counters<my::allocator>(trace, &mm_stats[i]);
+      }
+      if (latency) {
+        eval_mm_latency<my::allocator>(trace, &mm_stats[i]);
+      }
     }
+    /* Hand the pages of this trace's heap back before the next trace */
+    mm_stats[i].committed = mem_committed();
+    mem_reset_brk();
+    mem_trim(0);
     free_trace(trace);
   }
 
@@ -272,6 +427,12 @@ int main(int argc, char **argv) {
   if (verbose) {
     printf("\nResults for mm malloc:\n");
     printresults(num_tracefiles, tracefiles, mm_stats);
+    printcounters(num_tracefiles, mm_stats);
+    printf("\n");
+  }
+  if (latency) {
+    printf("Worst-case latencies for mm malloc:\n");
+    printlatencies(num_tracefiles, tracefiles, mm_stats);
     printf("\n");
   }
 
@@ -325,6 +486,8 @@ int main(int argc, char **argv) {
   /* Keep valgrind happy, free the statistics arrays. */
   free(libc_stats);
   free(bad_stats);
+  free(buddy_stats);
+  free(tlsf_stats);
   free(mm_stats);
 
   exit(0);
@@ -442,7 +605,27 @@ void free_trace(trace_t *trace) {
  **********************************************************************/
 
 /*
- * eval_mm_util - Evaluate the space utilization of the student's package
+ * set_site - Tag the requests that follow with an allocation site, for
+ *    the malloc packages that predict lifetimes from sites. Traces record
+ *    no call sites, so the size of each request stands in for its site,
+ *    as most sites always ask for the same size: size + 1 takes the place
+ *    of the return address that the allocator hashes into a site (0 would
+ *    make it use the return address again). Every evaluation of the mm
+ *    package tags its requests, so that they all see the same sites.
+ */
+template <class Type>
+void set_site(int size) {
+}
+
+template <>
+void set_site<my::allocator>(int size) {
+  if (use_sites) {
+    my::allocator::set_allocation_site(size + 1);
+  }
+}
+
+/*
+ * eval_mm_util - Evaluate the space utilization of a malloc package
  *   The idea is to remember the high water mark "hwm" of the heap for
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the
@@ -450,6 +633,7 @@ void free_trace(trace_t *trace) {
  *   package on the trace.
  *
  */
+template <class Type>
 static double eval_mm_util(trace_t *trace, int tracenum) {
   int i;
   int index;
@@ -462,7 +646,7 @@ static double eval_mm_util(trace_t *trace, int tracenum) {
 
   /* initialize the heap and the mm malloc package */
   mem_reset_brk();
-  if (my_impl.init() < 0) {
+  if (Type::init() < 0) {
     app_error("init failed in eval_mm_util");
   }
 
@@ -473,7 +657,8 @@ static double eval_mm_util(trace_t *trace, int tracenum) {
         index = trace->ops[i].index;
         size = trace->ops[i].size;
 
-        if ((p = (char *) my_impl.malloc(size)) == NULL) {
+        set_site<Type>(size);
+        if ((p = (char *) Type::malloc(size)) == NULL) {
           app_error("malloc failed in eval_mm_util");
         }
 
@@ -496,7 +681,8 @@ static double eval_mm_util(trace_t *trace, int tracenum) {
         oldsize = trace->block_sizes[index];
 
         oldp = trace->blocks[index];
-        if ((newp = (char *) my_impl.realloc(oldp,newsize)) == NULL)
+        set_site<Type>(newsize);
+        if ((newp = (char *) Type::realloc(oldp,newsize)) == NULL)
           app_error("realloc failed in eval_mm_util");
 
         /* Remember region and size */
@@ -517,7 +703,7 @@ static double eval_mm_util(trace_t *trace, int tracenum) {
         size = trace->block_sizes[index];
         p = trace->blocks[index];
 
-        my_impl.free(p);
+        Type::free(p);
 
         /* Keep track of current total size
          * of all allocated blocks */
@@ -540,15 +726,16 @@ static double eval_mm_util(trace_t *trace, int tracenum) {
 
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
- *    to measure the running time of the mm malloc package.
+ *    to measure the running time of a malloc package.
  */
+template <class Type>
 static void eval_mm_speed(trace_t *trace) {
   int i, index, size, newsize;
   char *p, *newp, *oldp, *block;
 
   /* Reset the heap and initialize the mm package */
   mem_reset_brk();
-  if (my_impl.init() < 0) {
+  if (Type::init() < 0) {
     app_error("init failed in eval_mm_speed");
   }
 
@@ -559,7 +746,8 @@ static void eval_mm_speed(trace_t *trace) {
       case ALLOC: /* malloc */
         index = trace->ops[i].index;
         size = trace->ops[i].size;
-        if ((p = (char *) my_impl.malloc(size)) == NULL)
+        set_site<Type>(size);
+        if ((p = (char *) Type::malloc(size)) == NULL)
           app_error("malloc error in eval_mm_speed");
         trace->blocks[index] = p;
         break;
@@ -568,7 +756,8 @@ static void eval_mm_speed(trace_t *trace) {
         index = trace->ops[i].index;
         newsize = trace->ops[i].size;
         oldp = trace->blocks[index];
-        if ((newp = (char *) my_impl.realloc(oldp,newsize)) == NULL)
+        set_site<Type>(newsize);
+        if ((newp = (char *) Type::realloc(oldp,newsize)) == NULL)
           app_error("realloc error in eval_mm_speed");
         trace->blocks[index] = newp;
         break;
@@ -576,7 +765,7 @@ static void eval_mm_speed(trace_t *trace) {
       case FREE: /* free */
         index = trace->ops[i].index;
         block = trace->blocks[index];
-        my_impl.free(block);
+        Type::free(block);
         break;
 
       default:
@@ -585,6 +774,93 @@ static void eval_mm_speed(trace_t *trace) {
   }
 }
 
+/*
+ * eval_mm_counters - Count the dTLB misses and page faults of one more
+ *    timed run of the mm malloc package over trace.
+ */
+template <class Type>
+static void eval_mm_counters(trace_t *trace, stats_t *stats) {
+  perfctr_start();
+  eval_mm_speed<Type>(trace);
+  stats->tlb_misses = (double) perfctr_read(PERFCTR_DTLB_MISSES);
+  stats->page_faults = (double) perfctr_read(PERFCTR_PAGE_FAULTS);
+  perfctr_stop();
+}
+
+/*
+ * eval_mm_latency - Time every request of a malloc package on trace in
+ *    cycles, and record the worst case of each kind of request. Of the
+ *    LATENCY_RUNS runs, the one with the smallest worst case is kept for
+ *    each kind, so that an interrupt during one request does not count.
+ */
+template <class Type>
+static void eval_mm_latency(trace_t *trace, stats_t *stats) {
+  int i, run, index, size, newsize;
+  char *p, *newp, *oldp, *block;
+  double cycles;
+  double max_cycles[3];
+
+  for (run = 0; run < LATENCY_RUNS; run++) {
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (Type::init() < 0) {
+      app_error("init failed in eval_mm_latency");
+    }
+    max_cycles[ALLOC] = max_cycles[FREE] = max_cycles[REALLOC] = 0;
+
+    /* Interpret and time each trace request */
+    for (i = 0; i < trace->num_ops; i++) {
+      switch (trace->ops[i].type) {
+
+        case ALLOC: /* malloc */
+          index = trace->ops[i].index;
+          size = trace->ops[i].size;
+          set_site<Type>(size);
+          start_counter();
+          p = (char *) Type::malloc(size);
+          cycles = get_counter();
+          if (p == NULL)
+            app_error("malloc error in eval_mm_latency");
+          trace->blocks[index] = p;
+          break;
+
+        case REALLOC: /* realloc */
+          index = trace->ops[i].index;
+          newsize = trace->ops[i].size;
+          oldp = trace->blocks[index];
+          set_site<Type>(newsize);
+          start_counter();
+          newp = (char *) Type::realloc(oldp,newsize);
+          cycles = get_counter();
+          if (newp == NULL)
+            app_error("realloc error in eval_mm_latency");
+          trace->blocks[index] = newp;
+          break;
+
+        case FREE: /* free */
+          index = trace->ops[i].index;
+          block = trace->blocks[index];
+          start_counter();
+          Type::free(block);
+          cycles = get_counter();
+          break;
+
+        default:
+          app_error("Nonexistent request type in eval_mm_latency");
+      }
+      if (cycles > max_cycles[trace->ops[i].type]) {
+        max_cycles[trace->ops[i].type] = cycles;
+      }
+    }
+
+    for (i = 0; i < 3; i++) {
+      if (run == 0 || max_cycles[i] < stats->max_cycles[i]) {
+        stats->max_cycles[i] = max_cycles[i];
+      }
+    }
+  }
+}
+
 /*
  * eval_mm_check - This function is used to check the heap of the student's
  *    implementation.  Returns 0 on check failure, and 1 on pass.
@@ -606,6 +882,7 @@ static int eval_mm_check(Type *impl, trace_t *trace, int tracenum) {
       case ALLOC: /* malloc */
         index = trace->ops[i].index;
         size = trace->ops[i].size;
+        set_site<Type>(size);
         if ((p = (char *) impl->malloc(size)) == NULL) {
           malloc_error(tracenum, i, "impl malloc failed.");
           return 0;
@@ -617,6 +894,7 @@ static int eval_mm_check(Type *impl, trace_t *trace, int tracenum) {
         index = trace->ops[i].index;
         newsize = trace->ops[i].size;
         oldp = trace->blocks[index];
+        set_site<Type>(newsize);
         if ((newp = (char *) impl->realloc(oldp,newsize)) == NULL) {
           malloc_error(tracenum, i, "impl realloc failed.");
           return 0;
@@ -747,6 +1025,77 @@ static void printresults(int n, char **tracefiles, stats_t *stats) {
 
 }
 
+/*
+ * printcounters - prints the dTLB misses and page faults per thousand ops
+ *    over the valid traces, as counted by eval_mm_counters, and the most
+ *    heap memory committed by any trace
+ */
+static void printcounters(int n, stats_t *stats) {
+  int i;
+  double ops = 0;
+  double tlb_misses = 0;
+  double page_faults = 0;
+  size_t committed = 0;
+
+  for (i = 0; i < n; i++) {
+    if (stats[i].valid) {
+      ops += stats[i].ops;
+      committed = (stats[i].committed > committed) ? stats[i].committed : committed;
+      tlb_misses = (stats[i].tlb_misses < 0 || tlb_misses < 0) ? -1 : tlb_misses + stats[i].tlb_misses;
+      page_faults = (stats[i].page_faults < 0 || page_faults < 0) ? -1 : page_faults + stats[i].page_faults;
+    }
+  }
+  if (ops == 0) {
+    return;
+  }
+  printf("Huge pages %s: ", mem_hugepages() ? "on" : "off");
+  if (tlb_misses < 0) {
+    printf("dTLB misses unavailable, ");
+  } else {
+    printf("%.1f dTLB misses, ", tlb_misses * 1e3 / ops);
+  }
+  if (page_faults < 0) {
+    printf("page faults unavailable ");
+  } else {
+    printf("%.1f page faults ", page_faults * 1e3 / ops);
+  }
+  printf("per Kop, at most %lu KB committed\n", (unsigned long) (committed >> 10));
+}
+
+/*
+ * printlatencies - prints the worst-case cycles of one malloc, free and
+ *    realloc on each valid trace, as measured by eval_mm_latency
+ */
+static void printlatencies(int n, char **tracefiles, stats_t *stats) {
+  int i, type;
+  double max_cycles[3] = {0, 0, 0};
+
+  printf("%5s%27s%12s%12s%12s\n",
+         "trace", "filename", "malloc", "free", "realloc");
+  for (i = 0; i < n; i++) {
+    if (stats[i].valid) {
+      printf("%2d%30s%12.0f%12.0f%12.0f\n",
+             i,
+             tracefiles[i],
+             stats[i].max_cycles[ALLOC],
+             stats[i].max_cycles[FREE],
+             stats[i].max_cycles[REALLOC]);
+      for (type = 0; type < 3; type++) {
+        if (stats[i].max_cycles[type] > max_cycles[type]) {
+          max_cycles[type] = stats[i].max_cycles[type];
+        }
+      }
+    } else {
+      printf("%2d%30s%12s%12s%12s\n", i, tracefiles[i], "-", "-", "-");
+    }
+  }
+  printf("%32s%12.0f%12.0f%12.0f cycles\n",
+         "Worst       ",
+         max_cycles[ALLOC],
+         max_cycles[FREE],
+         max_cycles[REALLOC]);
+}
+
 /*
  * app_error - Report an arbitrary application error
  */
@@ -775,12 +1124,17 @@ void malloc_error(int tracenum, int opnum, char *msg) {
  * usage - Explain the command line arguments
  */
 static void usage(void) {
-  fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+  fprintf(stderr, "Usage: mdriver [-hHvValBTLS] [-f <file>] [-t <dir>]\n");
   fprintf(stderr, "Options\n");
   fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+  fprintf(stderr, "\t-B         Run the buddy allocator as well.\n");
   fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
   fprintf(stderr, "\t-h         Print this message.\n");
+  fprintf(stderr, "\t-H         Lay the heap out on transparent huge pages.\n");
   fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+  fprintf(stderr, "\t-L         Report the worst-case cycles of each kind of request.\n");
+  fprintf(stderr, "\t-S         Tag mm requests with their size as allocation site.\n");
+  fprintf(stderr, "\t-T         Run the TLSF allocator as well.\n");
   fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
   fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
   fprintf(stderr, "\t-V         Print additional debug info.\n");
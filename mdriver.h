@@ -65,6 +65,8 @@ typedef struct {
  * Function prototypes
  *********************/
 
+template <class Type>
+void set_site(int size);
 void malloc_error(int tracenum, int opnum, char *msg);
 void unix_error(char *msg);
 void app_error(char *msg);
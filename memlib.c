@@ -2,14 +2,38 @@
  * memlib.c - a module that simulates the memory system.  Needed because it
  *            allows us to interleave calls from the student's malloc package
  *            with the system's malloc package in libc.
+ *
+ *            The heap is a single range of address space reserved with mmap
+ *            (PROT_NONE) at mem_init. Pages are committed (made readable and
+ *            writable) in MEM_COMMIT_CHUNK steps as the brk advances, and
+ *            decommitted again by mem_trim, so the memory
+ *            charged to the process tracks the heap actually in use. The
+ *            storage never comes from libc malloc, which also lets this
+ *            module back the LD_PRELOAD build (see preload.cpp).
+ *
+ *            With huge pages enabled (mem_set_hugepages or MEMLIB_HUGEPAGES),
+ *            the reservation is aligned to MEM_HUGE_PAGE_SIZE, pages are
+ *            committed a huge page at a time, and the committed part of the
+ *            heap, which is dense, is advised MADV_HUGEPAGE. Trimmed pages are
+ *            remapped without that advice, so they go back to small pages and
+ *            can be released independently. Purges only release whole huge
+ *            pages, so they never split one.
+ *
+ *            On a NUMA machine, mem_bind_node lets the caller place each part
+ *            of the heap on a node of its choosing before the part is first
+ *            touched. On a single-node machine it does nothing.
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sched.h>
+#include <sys/syscall.h>
 #include <string.h>
+#include <stdint.h>
 #include <errno.h>
+#include <fcntl.h>
 
 #include "memlib.h"
 #include "config.h"
@@ -18,20 +42,192 @@
 static char *mem_start_brk;  /* points to first byte of heap */
 static char *mem_brk;        /* points to last byte of heap */
 static char *mem_max_addr;   /* largest legal heap address */
+static char *mem_commit_brk; /* first byte past the committed pages */
+static size_t mem_max_heap;  /* size of the reserved range */
+static int mem_use_hugepages = -1; /* -1 until set, then 0 or 1 */
+static int mem_num_nodes = 1;      /* NUMA nodes that pages can be bound to */
+
+/* the preferred-node memory policy of mbind(2); see <linux/mempolicy.h> */
+#define MEM_MPOL_PREFERRED 1
+
+/*
+ * mem_parse_size - parse a byte count with an optional k, m or g suffix.
+ *    Returns 0 if the string is not a valid size.
+ */
+static size_t mem_parse_size(const char *s)
+{
+  char *end;
+  unsigned long long size = strtoull(s, &end, 10);
+
+  switch (*end) {
+    case 'g': case 'G': size <<= 10; /* fall through */
+    case 'm': case 'M': size <<= 10; /* fall through */
+    case 'k': case 'K': size <<= 10; end++; break;
+    default: break;
+  }
+  return (*end == '\0') ? (size_t)size : 0;
+}
+
+/*
+ * mem_round_up - round p up to a multiple of unit bytes from the heap start,
+ *    without going past the end of the reserved range
+ */
+static char *mem_round_up(char *p, size_t unit)
+{
+  size_t offset = (size_t)(p - mem_start_brk);
+  offset = (offset + unit - 1) & ~(unit - 1);
+  return (offset < mem_max_heap) ? mem_start_brk + offset : mem_max_addr;
+}
+
+/*
+ * mem_claim_commit_mark - wait until no other thread is moving the commit
+ *    mark, then claim it by setting its low bit, which the mark, a page
+ *    boundary, never has otherwise. Returns the mark. Commits and mem_trim
+ *    take turns this way, so that none of them ever takes pages another
+ *    has decommitted in the meantime for committed.
+ */
+static char *mem_claim_commit_mark(void)
+{
+  for (;;) {
+    char *committed = mem_commit_brk;
+    if (!((uintptr_t)committed & 1) &&
+        __sync_bool_compare_and_swap(&mem_commit_brk, committed, committed + 1)) {
+      return committed;
+    }
+    sched_yield();
+  }
+}
+
+/*
+ * mem_commit - make sure every page below end is readable and writable.
+ *    Safe to call from several threads at once.
+ */
+static int mem_commit(char *end)
+{
+  char *committed = mem_commit_brk;
+  char *target;
+
+  /* while the mark is claimed, a mem_trim may be about to decommit pages below it */
+  if (!((uintptr_t)committed & 1) && end <= committed) {
+    return 0;
+  }
+  committed = mem_claim_commit_mark();
+  if (end <= committed) {
+    __atomic_store_n(&mem_commit_brk, committed, __ATOMIC_RELEASE);
+    return 0;
+  }
+  target = mem_round_up(end, mem_use_hugepages ? MEM_HUGE_PAGE_SIZE : MEM_COMMIT_CHUNK);
+  if (mprotect(committed, (size_t)(target - committed), PROT_READ | PROT_WRITE) != 0) {
+    __atomic_store_n(&mem_commit_brk, committed, __ATOMIC_RELEASE);
+    return -1;
+  }
+#ifdef MADV_HUGEPAGE
+  /* only a hint; kernels without transparent huge pages keep small pages */
+  if (mem_use_hugepages) {
+    madvise(committed, (size_t)(target - committed), MADV_HUGEPAGE);
+  }
+#endif
+  __atomic_store_n(&mem_commit_brk, target, __ATOMIC_RELEASE);
+  return 0;
+}
+
+/*
+ * mem_count_nodes - return one more than the highest NUMA node number the
+ *    kernel reports as possible, or 1 if it reports none. Reads sysfs with
+ *    plain system calls, since libc's stdio may allocate through us.
+ */
+static int mem_count_nodes(void)
+{
+  char buf[64];
+  int fd = open("/sys/devices/system/node/possible", O_RDONLY);
+  ssize_t len;
+  int node = 0;
+  int i;
+
+  if (fd < 0) {
+    return 1;
+  }
+  len = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (len <= 0) {
+    return 1;
+  }
+  buf[len] = '\0';
+  /* the list ends with its highest node, e.g. "0-3" or "0,2" */
+  for (i = 0; i < len; i++) {
+    if (buf[i] >= '0' && buf[i] <= '9') {
+      node = node * 10 + (buf[i] - '0');
+    } else if (buf[i] == '-' || buf[i] == ',') {
+      node = 0;
+    }
+  }
+  return (node + 1 < MEM_MAX_NUMA_NODES) ? node + 1 : MEM_MAX_NUMA_NODES;
+}
+
+/*
+ * mem_set_hugepages - enable or disable the huge page layout. Takes effect
+ *    at the next mem_init; by default the MEMLIB_HUGEPAGES environment
+ *    variable decides (enabled when set to anything but 0).
+ */
+void mem_set_hugepages(int enable)
+{
+  mem_use_hugepages = (enable != 0);
+}
+
+/*
+ * mem_hugepages - return whether the huge page layout is in use
+ */
+int mem_hugepages(void)
+{
+  return mem_use_hugepages > 0;
+}
 
 /*
- * mem_init - initialize the memory system model
+ * mem_init - initialize the memory system model. The reservation size is
+ *    MAX_HEAP, or the value of the MEMLIB_MAX_HEAP environment variable
+ *    (bytes, with an optional k, m or g suffix) when it is set.
  */
 void mem_init(void)
 {
-  /* allocate the storage we will use to model the available VM */
-  if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-    fprintf(stderr, "mem_init_vm: malloc error\n");
+  const char *max_heap_env = getenv("MEMLIB_MAX_HEAP");
+  const char *hugepages_env = getenv("MEMLIB_HUGEPAGES");
+  size_t unit;
+  size_t slack;
+
+  if (mem_use_hugepages < 0) {
+    mem_use_hugepages = (hugepages_env && strcmp(hugepages_env, "0") != 0);
+  }
+  unit = mem_use_hugepages ? MEM_HUGE_PAGE_SIZE : mem_pagesize();
+  mem_max_heap = (max_heap_env && mem_parse_size(max_heap_env)) ? mem_parse_size(max_heap_env) : MAX_HEAP;
+  mem_max_heap = (mem_max_heap + unit - 1) & ~(unit - 1);
+
+  /*
+   * reserve the address space only; nothing is backed until it is committed.
+   * For huge pages, over-reserve by one huge page and cut the range down to
+   * an aligned one.
+   */
+  slack = mem_use_hugepages ? MEM_HUGE_PAGE_SIZE : 0;
+  mem_start_brk = (char *)mmap(NULL, mem_max_heap + slack, PROT_NONE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (mem_start_brk == MAP_FAILED) {
+    fprintf(stderr, "mem_init_vm: mmap error\n");
     exit(1);
   }
+  if (slack) {
+    char *aligned = (char *)(((size_t)mem_start_brk + slack - 1) & ~(slack - 1));
+    if (aligned > mem_start_brk) {
+      munmap(mem_start_brk, (size_t)(aligned - mem_start_brk));
+    }
+    if (aligned + mem_max_heap < mem_start_brk + mem_max_heap + slack) {
+      munmap(aligned + mem_max_heap, (size_t)(mem_start_brk + slack - aligned));
+    }
+    mem_start_brk = aligned;
+  }
 
-  mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-  mem_brk = mem_start_brk;                  /* heap is empty initially */
+  mem_max_addr = mem_start_brk + mem_max_heap;  /* max legal heap address */
+  mem_brk = mem_start_brk;                      /* heap is empty initially */
+  mem_commit_brk = mem_start_brk;               /* and nothing is committed */
+  mem_num_nodes = mem_count_nodes();
 }
 
 /*
@@ -39,11 +235,137 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-  free(mem_start_brk);
+  munmap(mem_start_brk, mem_max_heap);
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_trim - decommit the pages more than pad bytes past the brk, handing
+ *    them back to the kernel. The address space stays reserved, on small
+ *    pages, until it is committed again. May run while other threads
+ *    extend the heap: the brk is read only once the commit mark has been
+ *    claimed, and a thread that moves the brk on after that commits its
+ *    pages again once the mark is released.
+ */
+void mem_trim(size_t pad)
+{
+  char *committed = mem_claim_commit_mark();
+  char *brk = __atomic_load_n(&mem_brk, __ATOMIC_SEQ_CST);
+  /* never split a huge page; the partly used one at the brk stays committed */
+  char *keep = mem_round_up(brk + ((pad < mem_max_heap) ? pad : mem_max_heap),
+                            mem_use_hugepages ? MEM_HUGE_PAGE_SIZE : mem_pagesize());
+
+  /* mapping fresh PROT_NONE pages over the range drops both the pages and their commit charge */
+  if (keep >= committed || mmap(keep, (size_t)(committed - keep), PROT_NONE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED) {
+    keep = committed;
+  }
+  __atomic_store_n(&mem_commit_brk, keep, __ATOMIC_RELEASE);
+}
+
+/*
+ * mem_child_after_fork - release the commit mark in a child process if a
+ *    thread of the parent, which the child does not have, had claimed it
+ *    at the fork, and commit the pages below the brk, which such a thread
+ *    may have reserved without committing them again after a mem_trim.
+ *    Returns -1 if they cannot be committed.
+ */
+int mem_child_after_fork(void)
+{
+  mem_commit_brk = (char *)((uintptr_t)mem_commit_brk & ~(uintptr_t)1);
+  return mem_commit(mem_brk);
+}
+
+/*
+ * mem_numa_nodes - return the number of NUMA nodes that mem_bind_node can
+ *    place pages on; 1 on a machine without NUMA
+ */
+int mem_numa_nodes(void)
+{
+  return mem_num_nodes;
+}
+
+/*
+ * mem_bind_node - ask for the whole pages in [start, start + len) to be
+ *    placed on the given NUMA node when they are first touched. Pages that
+ *    were touched before keep their place. The node is only preferred, so
+ *    the pages still come from another node when it runs out of memory.
+ *    Does nothing on a single-node machine; returns 0 on success.
+ */
+int mem_bind_node(void *start, size_t len, int node)
+{
+  unsigned long mask[(MEM_MAX_NUMA_NODES + 8 * sizeof(unsigned long) - 1) / (8 * sizeof(unsigned long))];
+  size_t pagesize = mem_pagesize();
+  char *first = (char *)(((size_t)start + pagesize - 1) & ~(pagesize - 1));
+  char *last = (char *)(((size_t)start + len) & ~(pagesize - 1));
+
+  if (mem_num_nodes <= 1 || node < 0 || node >= mem_num_nodes || last <= first) {
+    return 0;
+  }
+  memset(mask, 0, sizeof(mask));
+  mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+  /* the kernel reads one bit fewer than maxnode */
+  return (int)syscall(SYS_mbind, first, (size_t)(last - first), MEM_MPOL_PREFERRED,
+                      mask, (unsigned long)(8 * sizeof(mask) + 1), 0);
+}
+
+/*
+ * mem_purge_range - narrow [start, start + len) to the units that a purge
+ *    releases whole, [*first, *last): huge pages in the huge page layout,
+ *    whose committed part is advised MADV_HUGEPAGE, so that a purge never
+ *    splits a huge page into small ones, and pages otherwise
+ */
+static void mem_purge_range(void *start, size_t len, char **first, char **last)
+{
+  size_t unit = mem_use_hugepages ? MEM_HUGE_PAGE_SIZE : mem_pagesize();
+
+  *first = (char *)(((size_t)start + unit - 1) & ~(unit - 1));
+  *last = (char *)(((size_t)start + len) & ~(unit - 1));
+}
+
+/*
+ * mem_purge - hand the whole pages in [start, start + len) back to the
+ *    kernel while keeping them committed; in the huge page layout, only
+ *    the whole huge pages. They read as zeros when they are next touched.
+ *    Returns 0 on success.
+ */
+int mem_purge(void *start, size_t len)
+{
+  char *first, *last;
+
+  mem_purge_range(start, len, &first, &last);
+  if (last <= first) {
+    return 0;
+  }
+  return madvise(first, (size_t)(last - first), MADV_DONTNEED);
+}
+
+/*
+ * mem_purge_lazy - like mem_purge, but the kernel only takes the pages
+ *    back when it runs short of memory (MADV_FREE), so pages touched again
+ *    before then cost no fault. They hold either their old contents or
+ *    zeros when they are next read. Falls back to mem_purge where
+ *    MADV_FREE is not available. Returns 0 on success.
+ */
+int mem_purge_lazy(void *start, size_t len)
+{
+#ifdef MADV_FREE
+  char *first, *last;
+
+  mem_purge_range(start, len, &first, &last);
+  if (last <= first) {
+    return 0;
+  }
+  if (madvise(first, (size_t)(last - first), MADV_FREE) == 0) {
+    return 0;
+  }
+#endif
+  return mem_purge(start, len);
+}
+
+/*
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap.
+ *    The pages stay committed, so the driver's repeated runs over a trace
+ *    do not pay the page faults again; call mem_trim to release them.
  */
 void mem_reset_brk(void)
 {
@@ -57,16 +379,50 @@ void mem_reset_brk(void)
  */
 void *mem_sbrk(int incr)
 {
-  char *old_brk = __sync_fetch_and_add(&mem_brk, incr);
+  for (;;) {
+    char *old_brk = mem_brk;
+    char *new_brk = old_brk + incr;
 
-  if ((incr < 0) || (mem_brk > mem_max_addr)) {
+    /* commit before publishing the new brk, so a failure leaves the heap untouched */
+    if ((incr < 0) || (new_brk > mem_max_addr) || (mem_commit(new_brk) != 0)) {
+      errno = ENOMEM;
+      fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory... (%ld)\n", mem_heapsize());
+      return (void *)-1;
+    }
+    if (__sync_bool_compare_and_swap(&mem_brk, old_brk, new_brk)) {
+      return (void *)old_brk;
+    }
+  }
+}
+
+/*
+ * mem_sbrk_cas - extend the heap by incr bytes, but only if the brk is
+ *    still at expected_brk, with a single compare-and-swap. A negative
+ *    incr shrinks the heap; the pages given up stay committed until
+ *    mem_trim decommits them. Returns
+ *    expected_brk on success, NULL if another caller has moved the brk,
+ *    and (void *)-1 with errno set to ENOMEM if the heap is out of memory.
+ *    Nothing is printed, as stdio may allocate, and in the LD_PRELOAD build
+ *    that would call back into the allocator.
+ */
+void *mem_sbrk_cas(void *expected_brk, int incr)
+{
+  char *new_brk = (char *)expected_brk + incr;
+
+  if ((new_brk < mem_start_brk) || (new_brk > mem_max_addr) || (incr > 0 && mem_commit(new_brk) != 0)) {
     errno = ENOMEM;
-    fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory... (%ld)\n", mem_heapsize());
-    __sync_fetch_and_add(&mem_brk, -incr);
     return (void *)-1;
   }
-
-  return (void *)old_brk;
+  if (!__sync_bool_compare_and_swap(&mem_brk, (char *)expected_brk, new_brk)) {
+    return NULL;
+  }
+  /* a mem_trim since the commit above may have decommitted the pages again */
+  if (incr > 0 && mem_commit(new_brk) != 0) {
+    __sync_bool_compare_and_swap(&mem_brk, new_brk, (char *)expected_brk);
+    errno = ENOMEM;
+    return (void *)-1;
+  }
+  return expected_brk;
 }
 
 /*
@@ -94,6 +450,23 @@ size_t mem_heapsize(void)
   return (size_t)(mem_brk - mem_start_brk);
 }
 
+/*
+ * mem_committed() - returns the number of heap bytes currently committed
+ */
+size_t mem_committed(void)
+{
+  /* a thread moving the mark has its low bit set */
+  return (size_t)(((uintptr_t)mem_commit_brk & ~(uintptr_t)1) - (uintptr_t)mem_start_brk);
+}
+
+/*
+ * mem_hugepagesize() - returns the huge page size used by the huge page layout
+ */
+size_t mem_hugepagesize(void)
+{
+  return (size_t)MEM_HUGE_PAGE_SIZE;
+}
+
 /*
  * mem_pagesize() - returns the page size of the system
  */
@@ -3,13 +3,24 @@
 
 #include <unistd.h>
 
+void mem_set_hugepages(int enable);
+int mem_hugepages(void);
 void mem_init(void);
 void mem_deinit(void);
 void *mem_sbrk(int incr);
+void *mem_sbrk_cas(void *expected_brk, int incr);
 void mem_reset_brk(void);
+void mem_trim(size_t pad);
+int mem_child_after_fork(void);
+int mem_numa_nodes(void);
+int mem_bind_node(void *start, size_t len, int node);
+int mem_purge(void *start, size_t len);
+int mem_purge_lazy(void *start, size_t len);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_committed(void);
 size_t mem_pagesize(void);
+size_t mem_hugepagesize(void);
 
 #endif /* MM_MEMLIB_H */
@@ -0,0 +1,158 @@
+/**
+ * Copyright (c) 2012 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+// new_delete.cpp - The replaceable global operator new and operator delete overloads of the
+// LD_PRELOAD build (see preload.cpp), including the nothrow, sized (C++14) and align_val_t (C++17)
+// forms. They call my::allocator directly rather than going through malloc and free. Sized
+// deletes free the block like the other deletes do: every block carries its size in its header,
+// which free needs to coalesce the block anyway, so the size passed in is not needed.
+
+#include <errno.h>
+#include <new>
+#include "./allocator_interface.h"
+#include "./preload.h"
+
+// Helper method that allocates size bytes aligned to alignment. When memory runs out, the installed
+// new_handler is given a chance to release some; without one, the throwing forms throw
+// std::bad_alloc and the nothrow forms return NULL.
+static inline void * newImpl(size_t size, size_t alignment, bool nothrow) {
+  for (;;) {
+    void * ptr;
+    if (!ensureHeapReady()) {
+      ptr = (alignment <= BOOTSTRAP_ALIGNMENT) ? bootstrapMalloc(size) : NULL;
+    } else if (alignment) {
+      ptr = my::allocator::memalign(alignment, size);
+    } else {
+      ptr = my::allocator::malloc(size);
+    }
+    if (ptr) {
+      return ptr;
+    }
+    std::new_handler handler = std::get_new_handler();
+    if (!handler) {
+      if (nothrow) {
+        errno = ENOMEM;
+        return NULL;
+      }
+      throw std::bad_alloc();
+    }
+    if (nothrow) {
+      try {
+        handler();
+      } catch (const std::bad_alloc &) {
+        return NULL;
+      }
+    } else {
+      handler();
+    }
+  }
+}
+
+// Helper method that releases memory obtained from newImpl
+static inline void deleteImpl(void * ptr) {
+  if (!ptr || isBootstrapPointer(ptr) || !isHeapPointer(ptr)) {
+    return;
+  }
+  my::allocator::free(ptr);
+}
+
+EXPORT void * operator new(size_t size) {
+  return newImpl(size, 0, false);
+}
+
+EXPORT void * operator new[](size_t size) {
+  return newImpl(size, 0, false);
+}
+
+EXPORT void * operator new(size_t size, const std::nothrow_t &) throw() {
+  return newImpl(size, 0, true);
+}
+
+EXPORT void * operator new[](size_t size, const std::nothrow_t &) throw() {
+  return newImpl(size, 0, true);
+}
+
+EXPORT void operator delete(void * ptr) throw() {
+  deleteImpl(ptr);
+}
+
+EXPORT void operator delete[](void * ptr) throw() {
+  deleteImpl(ptr);
+}
+
+EXPORT void operator delete(void * ptr, const std::nothrow_t &) throw() {
+  deleteImpl(ptr);
+}
+
+EXPORT void operator delete[](void * ptr, const std::nothrow_t &) throw() {
+  deleteImpl(ptr);
+}
+
+EXPORT void operator delete(void * ptr, size_t size) throw() {
+  deleteImpl(ptr);
+}
+
+EXPORT void operator delete[](void * ptr, size_t size) throw() {
+  deleteImpl(ptr);
+}
+
+#if __cplusplus >= 201703L
+EXPORT void * operator new(size_t size, std::align_val_t alignment) {
+  return newImpl(size, (size_t) alignment, false);
+}
+
+EXPORT void * operator new[](size_t size, std::align_val_t alignment) {
+  return newImpl(size, (size_t) alignment, false);
+}
+
+EXPORT void * operator new(size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+  return newImpl(size, (size_t) alignment, true);
+}
+
+EXPORT void * operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+  return newImpl(size, (size_t) alignment, true);
+}
+
+EXPORT void operator delete(void * ptr, std::align_val_t) noexcept {
+  deleteImpl(ptr);
+}
+
+EXPORT void operator delete[](void * ptr, std::align_val_t) noexcept {
+  deleteImpl(ptr);
+}
+
+EXPORT void operator delete(void * ptr, std::align_val_t, const std::nothrow_t &) noexcept {
+  deleteImpl(ptr);
+}
+
+EXPORT void operator delete[](void * ptr, std::align_val_t, const std::nothrow_t &) noexcept {
+  deleteImpl(ptr);
+}
+
+EXPORT void operator delete(void * ptr, size_t size, std::align_val_t) noexcept {
+  deleteImpl(ptr);
+}
+
+EXPORT void operator delete[](void * ptr, size_t size, std::align_val_t) noexcept {
+  deleteImpl(ptr);
+}
+#endif
@@ -0,0 +1,271 @@
+/**
+ * Copyright (c) 2012 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+#ifndef _OBJECT_POOL_H
+#define _OBJECT_POOL_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <new>
+#include "./allocator_interface.h"
+
+// The amount of memory requested from the underlying allocator each time a pool runs out of objects
+#define OBJECT_POOL_SLAB_SIZE (64 * 1024)
+
+// The number of objects moved between a thread's magazine and the shared depot at a time
+#define OBJECT_POOL_MAGAZINE_SIZE 64
+
+namespace my {
+
+// A pool of fixed-size objects of type T. Objects carry no header: a free object's storage
+// is reused to link it into an intrusive free list. Each thread caches free objects in its own
+// magazine, and full magazines are exchanged with a shared depot under a single lock. When a
+// thread exits, the objects left in its magazine go back to the depot. Slabs are refilled in
+// OBJECT_POOL_SLAB_SIZE chunks from Source (any class with the static malloc/free interface of
+// allocator_interface.h) and are never returned to it.
+template <class T, class Source = allocator>
+class object_pool {
+  // A slab must hold at least one object after its cache-line-aligned header
+  static_assert(sizeof(T) <= OBJECT_POOL_SLAB_SIZE - CACHE_LINE_SIZE,
+                "object_pool objects must fit in an OBJECT_POOL_SLAB_SIZE slab");
+
+public:
+  // Returns uninitialized storage for one T, or NULL if Source is out of memory
+  static T * allocate();
+  // Returns storage obtained from allocate() to the pool
+  static void deallocate(T * obj);
+  // Allocates and default-constructs a T
+  static T * create();
+  // Destroys and deallocates a T obtained from create()
+  static void destroy(T * obj);
+
+private:
+  // The layout of a free object, overlaid on the object's own storage
+  struct FreeObject {
+    FreeObject * next; // next free object in the same magazine
+    FreeObject * nextMagazine; // next full magazine in the depot (only valid on a magazine's first object)
+  };
+
+  // Header placed at the start of every slab so the pool can account for its slabs
+  struct Slab {
+    Slab * next;
+  };
+
+  // The distance between consecutive objects in a slab. Objects no bigger than a cache line are
+  // padded to a power of two so that they never straddle a line; bigger objects are padded to
+  // a whole number of lines.
+  static size_t stride();
+
+  static bool refillMagazine();
+  static void flushMagazine();
+  static void createThreadExitKey();
+  static void releaseMagazine(void *);
+
+  static __thread FreeObject * magazine;
+  static __thread uint32_t magazineCount;
+
+  static pthread_mutex_t depotLock;
+  static FreeObject * depot; // full magazines of OBJECT_POOL_MAGAZINE_SIZE objects each
+  static FreeObject * looseObjects; // objects left in the magazines of threads that have exited
+  static pthread_key_t threadExitKey;
+  static pthread_once_t threadExitKeyOnce;
+  static Slab * slabs;
+  static char * carveCursor; // next never-used object in the newest slab
+  static char * carveEnd;
+};
+
+template <class T, class Source>
+__thread typename object_pool<T, Source>::FreeObject * object_pool<T, Source>::magazine = 0;
+template <class T, class Source>
+__thread uint32_t object_pool<T, Source>::magazineCount = 0;
+template <class T, class Source>
+pthread_mutex_t object_pool<T, Source>::depotLock = PTHREAD_MUTEX_INITIALIZER;
+template <class T, class Source>
+typename object_pool<T, Source>::FreeObject * object_pool<T, Source>::depot = 0;
+template <class T, class Source>
+typename object_pool<T, Source>::FreeObject * object_pool<T, Source>::looseObjects = 0;
+template <class T, class Source>
+pthread_key_t object_pool<T, Source>::threadExitKey;
+template <class T, class Source>
+pthread_once_t object_pool<T, Source>::threadExitKeyOnce = PTHREAD_ONCE_INIT;
+template <class T, class Source>
+typename object_pool<T, Source>::Slab * object_pool<T, Source>::slabs = 0;
+template <class T, class Source>
+char * object_pool<T, Source>::carveCursor = 0;
+template <class T, class Source>
+char * object_pool<T, Source>::carveEnd = 0;
+
+template <class T, class Source>
+inline size_t object_pool<T, Source>::stride() {
+  size_t size = (sizeof(T) > sizeof(FreeObject)) ? sizeof(T) : sizeof(FreeObject);
+  if (size > CACHE_LINE_SIZE) {
+    return (size + CACHE_LINE_SIZE - 1) & ~((size_t) CACHE_LINE_SIZE - 1);
+  }
+  size_t s = sizeof(FreeObject);
+  while (s < size) {
+    s <<= 1;
+  }
+  return s;
+}
+
+// Helper method that creates the key whose destructor releases an exiting thread's magazine,
+// once per pool
+template <class T, class Source>
+void object_pool<T, Source>::createThreadExitKey() {
+  pthread_key_create(&threadExitKey, releaseMagazine);
+}
+
+// Helper method, run as the destructor of threadExitKey when a thread exits, that hands the
+// objects left in the thread's magazine over to the loose objects of the depot
+template <class T, class Source>
+void object_pool<T, Source>::releaseMagazine(void *) {
+  if (!magazine) {
+    return;
+  }
+  FreeObject * last = magazine;
+  while (last->next) {
+    last = last->next;
+  }
+  pthread_mutex_lock(&depotLock);
+  last->next = looseObjects;
+  looseObjects = magazine;
+  pthread_mutex_unlock(&depotLock);
+  magazine = 0;
+  magazineCount = 0;
+}
+
+// Helper method that fills the calling thread's empty magazine, preferably with a full magazine
+// from the depot, then with the objects that exited threads left behind, otherwise by carving
+// objects out of the newest slab (refilling it from Source if it is used up)
+template <class T, class Source>
+bool object_pool<T, Source>::refillMagazine() {
+  size_t objectStride = stride();
+  // A thread that takes objects from the pool gets its magazine released when it exits
+  pthread_once(&threadExitKeyOnce, createThreadExitKey);
+  if (!pthread_getspecific(threadExitKey)) {
+    pthread_setspecific(threadExitKey, (void *) 1);
+  }
+  pthread_mutex_lock(&depotLock);
+  if (depot) {
+    magazine = depot;
+    depot = depot->nextMagazine;
+    pthread_mutex_unlock(&depotLock);
+    magazineCount = OBJECT_POOL_MAGAZINE_SIZE;
+    return true;
+  }
+  if (looseObjects) {
+    FreeObject * head = looseObjects;
+    FreeObject * last = head;
+    uint32_t count = 1;
+    while (count < OBJECT_POOL_MAGAZINE_SIZE && last->next) {
+      last = last->next;
+      count++;
+    }
+    looseObjects = last->next;
+    last->next = 0;
+    pthread_mutex_unlock(&depotLock);
+    magazine = head;
+    magazineCount = count;
+    return true;
+  }
+  if (carveCursor + objectStride > carveEnd) {
+    char * raw = (char *) Source::malloc(OBJECT_POOL_SLAB_SIZE);
+    if (!raw) {
+      pthread_mutex_unlock(&depotLock);
+      return false;
+    }
+    Slab * slab = (Slab *) raw;
+    slab->next = slabs;
+    slabs = slab;
+    carveCursor = (char *) (((uintptr_t) raw + sizeof(Slab) + CACHE_LINE_SIZE - 1) & ~((uintptr_t) CACHE_LINE_SIZE - 1));
+    carveEnd = raw + OBJECT_POOL_SLAB_SIZE;
+  }
+  FreeObject * head = 0;
+  uint32_t count = 0;
+  while (count < OBJECT_POOL_MAGAZINE_SIZE && carveCursor + objectStride <= carveEnd) {
+    FreeObject * obj = (FreeObject *) carveCursor;
+    obj->next = head;
+    head = obj;
+    carveCursor += objectStride;
+    count++;
+  }
+  pthread_mutex_unlock(&depotLock);
+  magazine = head;
+  magazineCount = count;
+  return count > 0;
+}
+
+// Helper method that moves OBJECT_POOL_MAGAZINE_SIZE objects from the calling thread's
+// magazine to the depot as one full magazine
+template <class T, class Source>
+void object_pool<T, Source>::flushMagazine() {
+  FreeObject * first = magazine;
+  FreeObject * last = first;
+  for (uint32_t i = 1; i < OBJECT_POOL_MAGAZINE_SIZE; i++) {
+    last = last->next;
+  }
+  magazine = last->next;
+  magazineCount -= OBJECT_POOL_MAGAZINE_SIZE;
+  last->next = 0;
+  pthread_mutex_lock(&depotLock);
+  first->nextMagazine = depot;
+  depot = first;
+  pthread_mutex_unlock(&depotLock);
+}
+
+template <class T, class Source>
+inline T * object_pool<T, Source>::allocate() {
+  if (!magazine && !refillMagazine()) {
+    return NULL;
+  }
+  FreeObject * obj = magazine;
+  magazine = obj->next;
+  magazineCount--;
+  return (T *) obj;
+}
+
+template <class T, class Source>
+inline void object_pool<T, Source>::deallocate(T * obj) {
+  FreeObject * freeObj = (FreeObject *) obj;
+  freeObj->next = magazine;
+  magazine = freeObj;
+  magazineCount++;
+  // Keep up to two magazines' worth locally so that alternating allocate/deallocate
+  // around the boundary does not bounce a magazine through the depot every time
+  if (magazineCount >= 2 * OBJECT_POOL_MAGAZINE_SIZE) {
+    flushMagazine();
+  }
+}
+
+template <class T, class Source>
+inline T * object_pool<T, Source>::create() {
+  T * obj = allocate();
+  return obj ? new (obj) T() : NULL;
+}
+
+template <class T, class Source>
+inline void object_pool<T, Source>::destroy(T * obj) {
+  obj->~T();
+  deallocate(obj);
+}
+};
+#endif  // _OBJECT_POOL_H
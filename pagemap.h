@@ -0,0 +1,141 @@
+/**
+ * Copyright (c) 2012 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+#ifndef _PAGEMAP_H
+#define _PAGEMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+// pagemap.h - A radix tree that maps any address to a pointer recorded for the page it lies on.
+//
+// The page number of an address is split into three PAGE_MAP_LEVEL_BITS-bit digits. The root is part of the
+// map itself; the nodes below it are mapped from the kernel, zero-filled, the first time a page under them is
+// set, and are never released, so lookups take no lock and never touch the heap the map describes. Pages that
+// were never set map to NULL.
+
+// Pages are 4 KB, and addresses have 48 significant bits
+#define PAGE_MAP_PAGE_SHIFT 12
+#define PAGE_MAP_ADDRESS_BITS 48
+#define PAGE_MAP_LEVEL_BITS ((PAGE_MAP_ADDRESS_BITS - PAGE_MAP_PAGE_SHIFT) / 3)
+#define PAGE_MAP_LEVEL_SIZE (1 << PAGE_MAP_LEVEL_BITS)
+
+namespace my {
+
+// A node below the root: the middle nodes hold leaves, the leaves hold the values of PAGE_MAP_LEVEL_SIZE pages
+struct PageMapNode {
+  void * volatile entries[PAGE_MAP_LEVEL_SIZE];
+};
+
+// A page map. A zeroed map is empty.
+struct PageMap {
+  PageMapNode * volatile root[PAGE_MAP_LEVEL_SIZE];
+};
+
+// Helper method that returns the page number of an address
+static inline uintptr_t pageMapPage(const void * address) {
+  return ((uintptr_t) address >> PAGE_MAP_PAGE_SHIFT) & (((uintptr_t) 1 << (3 * PAGE_MAP_LEVEL_BITS)) - 1);
+}
+
+// Helper method that returns the node in the given slot, mapping a zero-filled one first if there is none yet.
+// When two threads race to fill the slot, the loser unmaps its node. Returns NULL if no memory can be mapped.
+static inline PageMapNode * pageMapNode(PageMapNode * volatile * slot) {
+  PageMapNode * node = *slot;
+  if (node) {
+    return node;
+  }
+  void * fresh = mmap(NULL, sizeof(PageMapNode), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (fresh == MAP_FAILED) {
+    return NULL;
+  }
+  if (!__sync_bool_compare_and_swap(slot, (PageMapNode *) NULL, (PageMapNode *) fresh)) {
+    munmap(fresh, sizeof(PageMapNode));
+  }
+  return *slot;
+}
+
+// Returns the value recorded for the page that address lies on, or NULL if none was
+static inline void * pageMapGet(PageMap * map, const void * address) {
+  uintptr_t page = pageMapPage(address);
+  PageMapNode * middle = map->root[page >> (2 * PAGE_MAP_LEVEL_BITS)];
+  if (!middle) {
+    return NULL;
+  }
+  PageMapNode * leaf = (PageMapNode *) middle->entries[(page >> PAGE_MAP_LEVEL_BITS) & (PAGE_MAP_LEVEL_SIZE - 1)];
+  if (!leaf) {
+    return NULL;
+  }
+  return leaf->entries[page & (PAGE_MAP_LEVEL_SIZE - 1)];
+}
+
+// Helper method that returns the leaf holding the entry of the given page number, mapping the nodes on the way to
+// it first if need be. Returns NULL if they cannot be mapped.
+static inline PageMapNode * pageMapLeaf(PageMap * map, uintptr_t page) {
+  uintptr_t key = page & (((uintptr_t) 1 << (3 * PAGE_MAP_LEVEL_BITS)) - 1);
+  PageMapNode * middle = pageMapNode(&(map->root[key >> (2 * PAGE_MAP_LEVEL_BITS)]));
+  if (!middle) {
+    return NULL;
+  }
+  return pageMapNode((PageMapNode * volatile *) &(middle->entries[(key >> PAGE_MAP_LEVEL_BITS) & (PAGE_MAP_LEVEL_SIZE - 1)]));
+}
+
+// Helper method that returns the page numbers of the first page that starts in [start, start + length), and of the
+// page after the last one
+static inline void pageMapPages(const void * start, size_t length, uintptr_t * first, uintptr_t * last) {
+  *first = ((uintptr_t) start + ((uintptr_t) 1 << PAGE_MAP_PAGE_SHIFT) - 1) >> PAGE_MAP_PAGE_SHIFT;
+  *last = ((uintptr_t) start + length + ((uintptr_t) 1 << PAGE_MAP_PAGE_SHIFT) - 1) >> PAGE_MAP_PAGE_SHIFT;
+}
+
+// Maps the nodes that hold the entries of every page that starts in [start, start + length), without changing
+// any entry, so that a later pageMapSetRange over those pages cannot fail. Returns false if they cannot be mapped.
+static inline bool pageMapReserve(PageMap * map, const void * start, size_t length) {
+  uintptr_t first, last;
+  pageMapPages(start, length, &first, &last);
+  for (uintptr_t page = first; page < last; page = (page | (PAGE_MAP_LEVEL_SIZE - 1)) + 1) {
+    if (!pageMapLeaf(map, page)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Records value for every page that starts in [start, start + length), so that a page belongs to whichever range
+// holds its first byte. Returns false if the nodes for those pages could not be mapped.
+static inline bool pageMapSetRange(PageMap * map, const void * start, size_t length, void * value) {
+  uintptr_t first, last;
+  pageMapPages(start, length, &first, &last);
+  for (uintptr_t page = first; page < last; ) {
+    PageMapNode * leaf = pageMapLeaf(map, page);
+    if (!leaf) {
+      return false;
+    }
+    // Fill the rest of this leaf in one go
+    for (uintptr_t i = page & (PAGE_MAP_LEVEL_SIZE - 1); i < PAGE_MAP_LEVEL_SIZE && page < last; i++, page++) {
+      leaf->entries[i] = value;
+    }
+  }
+  return true;
+}
+
+};
+#endif  // _PAGEMAP_H
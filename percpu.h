@@ -0,0 +1,187 @@
+/**
+ * Copyright (c) 2012 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+#ifndef _PERCPU_H
+#define _PERCPU_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// percpu.h - Per-CPU stacks of cached pointers, shared without locks by all the threads that run on a CPU.
+//
+// Each push and pop is a Linux restartable sequence (rseq): the kernel restarts it from the top if the thread
+// is preempted, migrated or signalled before its single committing store, so no other thread on the same CPU
+// can ever observe it half done. The sequences use the rseq area that glibc (2.35 and later) registers for
+// every thread. Where there is no such area, or the thread runs on a CPU beyond PERCPU_MAXIMUM_CPUS, every
+// push and pop simply fails and the caller falls back to its own path.
+
+#if defined(__x86_64__) && defined(__linux__) && defined(__has_include)
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define PERCPU_HAVE_RSEQ 1
+#endif
+#endif
+
+// The number of CPUs that get a cache of their own
+#define PERCPU_MAXIMUM_CPUS 256
+
+// The signature the kernel expects in the four bytes before a restartable sequence's abort handler
+#define PERCPU_RSEQ_SIGNATURE 0x53053053
+
+namespace my {
+
+// The caches of one CPU: for each of NUM_CLASSES classes, a stack of up to CAPACITY pointers.
+// Each CPU's caches start on a cache line of their own.
+template <int NUM_CLASSES, int CAPACITY>
+struct PerCpuCache {
+  uint32_t counts[NUM_CLASSES];
+  void * slots[NUM_CLASSES][CAPACITY];
+} __attribute__((aligned(64)));
+
+#ifdef PERCPU_HAVE_RSEQ
+
+// Returns whether the kernel and glibc provide restartable sequences to this process
+static inline bool percpuAvailable() {
+  return __rseq_size > 0;
+}
+
+// Returns the calling thread's rseq area
+static inline struct rseq * percpuRseqArea() {
+  return (struct rseq *) ((char *) __builtin_thread_pointer() + __rseq_offset);
+}
+
+// Pops a pointer off the given class of the current CPU's cache. Returns NULL if that class is empty.
+template <int NUM_CLASSES, int CAPACITY>
+static inline void * percpuPop(PerCpuCache<NUM_CLASSES, CAPACITY> * caches, long cls) {
+  typedef PerCpuCache<NUM_CLASSES, CAPACITY> Cache;
+  struct rseq * rs = percpuRseqArea();
+  void * result;
+  uintptr_t cache, count;
+  __asm__ __volatile__ (
+    ".pushsection __rseq_cs, \"aw\"\n\t"
+    ".balign 32\n\t"
+    "3:\n\t"
+    ".long 0, 0\n\t"
+    ".quad 1f, 2f - 1f, 4f\n\t"
+    ".popsection\n\t"
+    "5:\n\t"
+    "leaq 3b(%%rip), %[cache]\n\t"
+    "movq %[cache], %c[rseqCsOffset](%[rs])\n\t"
+    "1:\n\t"
+    "xorl %k[result], %k[result]\n\t"
+    "movl %c[cpuIdOffset](%[rs]), %k[cache]\n\t"
+    "cmpl %[maximumCpus], %k[cache]\n\t"
+    "jae 2f\n\t"
+    "imulq %[cacheSize], %[cache], %[cache]\n\t"
+    "addq %[caches], %[cache]\n\t"
+    "movl (%[cache], %[cls], 4), %k[count]\n\t"
+    "testl %k[count], %k[count]\n\t"
+    "jz 2f\n\t"
+    "decl %k[count]\n\t"
+    "addq %[firstSlot], %[count]\n\t"
+    "movq %c[slotsOffset](%[cache], %[count], 8), %[result]\n\t"
+    "subq %[firstSlot], %[count]\n\t"
+    "movl %k[count], (%[cache], %[cls], 4)\n\t" // commit
+    "2:\n\t"
+    ".pushsection __rseq_failure, \"ax\"\n\t"
+    ".byte 0x0f, 0xb9, 0x3d\n\t"
+    ".long %c[signature]\n\t"
+    "4:\n\t"
+    "jmp 5b\n\t"
+    ".popsection\n\t"
+    : [result] "=&r" (result), [cache] "=&r" (cache), [count] "=&r" (count)
+    : [rs] "r" (rs), [caches] "r" (caches), [cls] "r" (cls), [firstSlot] "r" (cls * CAPACITY),
+      [rseqCsOffset] "i" (offsetof(struct rseq, rseq_cs)), [cpuIdOffset] "i" (offsetof(struct rseq, cpu_id)),
+      [maximumCpus] "i" (PERCPU_MAXIMUM_CPUS), [cacheSize] "i" (sizeof(Cache)),
+      [slotsOffset] "i" (offsetof(Cache, slots)), [signature] "i" (PERCPU_RSEQ_SIGNATURE)
+    : "memory", "cc");
+  return result;
+}
+
+// Pushes a pointer onto the given class of the current CPU's cache. Returns false if that class is full.
+template <int NUM_CLASSES, int CAPACITY>
+static inline bool percpuPush(PerCpuCache<NUM_CLASSES, CAPACITY> * caches, long cls, void * ptr) {
+  typedef PerCpuCache<NUM_CLASSES, CAPACITY> Cache;
+  struct rseq * rs = percpuRseqArea();
+  uintptr_t result, cache, count;
+  __asm__ __volatile__ (
+    ".pushsection __rseq_cs, \"aw\"\n\t"
+    ".balign 32\n\t"
+    "3:\n\t"
+    ".long 0, 0\n\t"
+    ".quad 1f, 2f - 1f, 4f\n\t"
+    ".popsection\n\t"
+    "5:\n\t"
+    "leaq 3b(%%rip), %[cache]\n\t"
+    "movq %[cache], %c[rseqCsOffset](%[rs])\n\t"
+    "1:\n\t"
+    "xorl %k[result], %k[result]\n\t"
+    "movl %c[cpuIdOffset](%[rs]), %k[cache]\n\t"
+    "cmpl %[maximumCpus], %k[cache]\n\t"
+    "jae 2f\n\t"
+    "imulq %[cacheSize], %[cache], %[cache]\n\t"
+    "addq %[caches], %[cache]\n\t"
+    "movl (%[cache], %[cls], 4), %k[count]\n\t"
+    "cmpl %[capacity], %k[count]\n\t"
+    "jae 2f\n\t"
+    "addq %[firstSlot], %[count]\n\t"
+    "movq %[ptr], %c[slotsOffset](%[cache], %[count], 8)\n\t" // the slot is above the count until the commit
+    "subq %[firstSlot], %[count]\n\t"
+    "incl %k[count]\n\t"
+    "movl $1, %k[result]\n\t"
+    "movl %k[count], (%[cache], %[cls], 4)\n\t" // commit
+    "2:\n\t"
+    ".pushsection __rseq_failure, \"ax\"\n\t"
+    ".byte 0x0f, 0xb9, 0x3d\n\t"
+    ".long %c[signature]\n\t"
+    "4:\n\t"
+    "jmp 5b\n\t"
+    ".popsection\n\t"
+    : [result] "=&r" (result), [cache] "=&r" (cache), [count] "=&r" (count)
+    : [rs] "r" (rs), [caches] "r" (caches), [cls] "r" (cls), [firstSlot] "r" (cls * CAPACITY), [ptr] "r" (ptr),
+      [rseqCsOffset] "i" (offsetof(struct rseq, rseq_cs)), [cpuIdOffset] "i" (offsetof(struct rseq, cpu_id)),
+      [maximumCpus] "i" (PERCPU_MAXIMUM_CPUS), [capacity] "i" (CAPACITY),
+      [cacheSize] "i" (sizeof(Cache)),
+      [slotsOffset] "i" (offsetof(Cache, slots)), [signature] "i" (PERCPU_RSEQ_SIGNATURE)
+    : "memory", "cc");
+  return result;
+}
+
+#else
+
+static inline bool percpuAvailable() {
+  return false;
+}
+
+template <int NUM_CLASSES, int CAPACITY>
+static inline void * percpuPop(PerCpuCache<NUM_CLASSES, CAPACITY> * caches, long cls) {
+  return NULL;
+}
+
+template <int NUM_CLASSES, int CAPACITY>
+static inline bool percpuPush(PerCpuCache<NUM_CLASSES, CAPACITY> * caches, long cls, void * ptr) {
+  return false;
+}
+
+#endif
+};
+#endif  // _PERCPU_H
@@ -0,0 +1,123 @@
+/*
+ * perfctr.c - per-process hardware event counters using perf_event_open.
+ *
+ * Each logical event is the sum of one or more perf events; an event whose
+ * perf events all fail to open is reported as unavailable (-1).
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "perfctr.h"
+
+#define PERFCTR_MAX_PARTS 2
+
+/* encode a PERF_TYPE_HW_CACHE config */
+#define HW_CACHE_CONFIG(cache, op, result) \
+  ((cache) | ((op) << 8) | ((result) << 16))
+
+typedef struct {
+  unsigned int type;
+  unsigned long long config;
+} perfctr_part_t;
+
+static const perfctr_part_t perfctr_parts[PERFCTR_NUM_EVENTS][PERFCTR_MAX_PARTS] = {
+  /* PERFCTR_DTLB_MISSES */
+  {{PERF_TYPE_HW_CACHE, HW_CACHE_CONFIG(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ,
+                                        PERF_COUNT_HW_CACHE_RESULT_MISS)},
+   {PERF_TYPE_HW_CACHE, HW_CACHE_CONFIG(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_WRITE,
+                                        PERF_COUNT_HW_CACHE_RESULT_MISS)}},
+  /* PERFCTR_PAGE_FAULTS; the second part is unused */
+  {{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+   {PERF_TYPE_MAX, 0}}
+};
+
+static int perfctr_fds[PERFCTR_NUM_EVENTS][PERFCTR_MAX_PARTS];
+static int perfctr_started = 0;
+
+/*
+ * perfctr_open - open one counter for this process and its future threads,
+ *    returning its file descriptor or -1
+ */
+static int perfctr_open(const perfctr_part_t *part)
+{
+  struct perf_event_attr attr;
+
+  if (part->type == PERF_TYPE_MAX) {
+    return -1;
+  }
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = part->type;
+  attr.config = part->config;
+  attr.disabled = 1;
+  attr.inherit = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/*
+ * perfctr_start - open, reset and enable all counters
+ */
+void perfctr_start(void)
+{
+  int i, j;
+
+  if (perfctr_started) {
+    perfctr_stop();
+  }
+  for (i = 0; i < PERFCTR_NUM_EVENTS; i++) {
+    for (j = 0; j < PERFCTR_MAX_PARTS; j++) {
+      perfctr_fds[i][j] = perfctr_open(&perfctr_parts[i][j]);
+      if (perfctr_fds[i][j] >= 0) {
+        ioctl(perfctr_fds[i][j], PERF_EVENT_IOC_RESET, 0);
+        ioctl(perfctr_fds[i][j], PERF_EVENT_IOC_ENABLE, 0);
+      }
+    }
+  }
+  perfctr_started = 1;
+}
+
+/*
+ * perfctr_read - return the count of event since perfctr_start, or -1
+ */
+long long perfctr_read(perfctr_event_t event)
+{
+  long long total = -1;
+  long long count;
+  int j;
+
+  if (!perfctr_started) {
+    return -1;
+  }
+  for (j = 0; j < PERFCTR_MAX_PARTS; j++) {
+    if (perfctr_fds[event][j] >= 0 &&
+        read(perfctr_fds[event][j], &count, sizeof(count)) == sizeof(count)) {
+      total = (total < 0) ? count : total + count;
+    }
+  }
+  return total;
+}
+
+/*
+ * perfctr_stop - close all counters
+ */
+void perfctr_stop(void)
+{
+  int i, j;
+
+  if (!perfctr_started) {
+    return;
+  }
+  for (i = 0; i < PERFCTR_NUM_EVENTS; i++) {
+    for (j = 0; j < PERFCTR_MAX_PARTS; j++) {
+      if (perfctr_fds[i][j] >= 0) {
+        close(perfctr_fds[i][j]);
+      }
+    }
+  }
+  perfctr_started = 0;
+}
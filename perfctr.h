@@ -0,0 +1,26 @@
+#ifndef MM_PERFCTR_H
+#define MM_PERFCTR_H
+
+/*
+ * perfctr.h - per-process hardware event counters (Linux perf_event)
+ *
+ * The counters cover the calling thread and every thread it creates
+ * after perfctr_start. An event the machine or kernel does not expose
+ * (e.g. no PMU in a VM, or perf_event_paranoid too high) reads as -1.
+ */
+typedef enum {
+  PERFCTR_DTLB_MISSES,  /* data TLB load and store misses, user space only */
+  PERFCTR_PAGE_FAULTS,  /* page faults taken by the process */
+  PERFCTR_NUM_EVENTS
+} perfctr_event_t;
+
+/* Open, reset and enable all counters */
+void perfctr_start(void);
+
+/* Return the count of event since perfctr_start, or -1 if unavailable */
+long long perfctr_read(perfctr_event_t event);
+
+/* Close all counters */
+void perfctr_stop(void);
+
+#endif  /* MM_PERFCTR_H */
@@ -0,0 +1,217 @@
+/**
+ * Copyright (c) 2012 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+// preload.cpp - Replaces the system malloc with my::allocator in unmodified programs:
+//
+//   make preload
+//   LD_PRELOAD=./libmyalloc.so <program>
+//
+// memlib and the allocator are set up by the first allocation. Any allocation made while that
+// setup is still running on the same thread is served from a small static bootstrap arena whose
+// blocks are never reused. The C++ entry points are in new_delete.cpp.
+//
+// The allocator's locks are taken around fork (see allocator::prepare_fork), so that a child of a
+// multithreaded program can keep allocating.
+//
+// Setting MYALLOC_BACKGROUND_INTERVAL to a number of milliseconds also starts the allocator's
+// background maintenance thread (see allocator::start_background_thread) once the heap is ready.
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include "./allocator_interface.h"
+#include "./memlib.h"
+#include "./preload.h"
+
+volatile int heapState = HEAP_UNINITIALIZED;
+static __thread bool isInitializingThread = false;
+
+char bootstrapArena[BOOTSTRAP_ARENA_SIZE] __attribute__((aligned(BOOTSTRAP_ALIGNMENT)));
+static size_t bootstrapUsed = 0;
+
+// Carves a block out of the bootstrap arena, recording its size in front of it
+void * bootstrapMalloc(size_t size) {
+  size_t total = BOOTSTRAP_ALIGNMENT + ((size + BOOTSTRAP_ALIGNMENT - 1) & ~((size_t) BOOTSTRAP_ALIGNMENT - 1));
+  size_t offset = __sync_fetch_and_add(&bootstrapUsed, total);
+  if (size > BOOTSTRAP_ARENA_SIZE || offset + total > BOOTSTRAP_ARENA_SIZE) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  char * block = bootstrapArena + offset;
+  *(size_t *) block = size;
+  return block + BOOTSTRAP_ALIGNMENT;
+}
+
+// Sets up memlib and the allocator the first time any thread allocates; the slow path of ensureHeapReady
+bool initializeHeap() {
+  if (isInitializingThread) {
+    return false;
+  }
+  if (__sync_bool_compare_and_swap(&heapState, HEAP_UNINITIALIZED, HEAP_INITIALIZING)) {
+    isInitializingThread = true;
+    mem_init();
+    my::allocator::init();
+    pthread_atfork(my::allocator::prepare_fork, my::allocator::parent_after_fork,
+                   my::allocator::child_after_fork);
+    isInitializingThread = false;
+    __sync_synchronize();
+    heapState = HEAP_READY;
+    const char * interval = getenv("MYALLOC_BACKGROUND_INTERVAL");
+    if (interval && atoi(interval) > 0) {
+      my::allocator::start_background_thread(atoi(interval), BACKGROUND_BUDGET);
+    }
+    return true;
+  }
+  while (heapState != HEAP_READY) {
+    sched_yield();
+  }
+  return true;
+}
+
+// Helper method shared by the aligned allocation entry points
+static inline void * alignedMalloc(size_t alignment, size_t size) {
+  if (!ensureHeapReady()) {
+    return (alignment <= BOOTSTRAP_ALIGNMENT) ? bootstrapMalloc(size) : NULL;
+  }
+  void * ptr = my::allocator::memalign(alignment, size);
+  if (!ptr) {
+    errno = ENOMEM;
+  }
+  return ptr;
+}
+
+// Helper method that returns whether alignment is a power of two
+static inline bool isPowerOfTwo(size_t alignment) {
+  return alignment && !(alignment & (alignment - 1));
+}
+
+extern "C" {
+
+EXPORT void * malloc(size_t size) {
+  if (!ensureHeapReady()) {
+    return bootstrapMalloc(size);
+  }
+#ifdef LIFETIME_HEAPS
+  // Name the caller as the allocation site, which would otherwise be this function for every block
+  my::allocator::set_allocation_site((size_t) __builtin_return_address(0));
+#endif
+  void * ptr = my::allocator::malloc(size);
+  if (!ptr) {
+    errno = ENOMEM;
+  }
+  return ptr;
+}
+
+EXPORT void free(void * ptr) {
+  if (!ptr || isBootstrapPointer(ptr) || !isHeapPointer(ptr)) {
+    return;
+  }
+  my::allocator::free(ptr);
+}
+
+EXPORT void * calloc(size_t count, size_t size) {
+  if (size && count > SIZE_MAX / size) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  void * ptr = malloc(count * size);
+  if (ptr) {
+    memset(ptr, 0, count * size);
+  }
+  return ptr;
+}
+
+EXPORT void * realloc(void * ptr, size_t size) {
+  if (!ptr) {
+    return malloc(size);
+  }
+  if (!size) {
+    free(ptr);
+    return NULL;
+  }
+  if (isBootstrapPointer(ptr)) {
+    void * newptr = malloc(size);
+    if (newptr) {
+      size_t oldSize = bootstrapSize(ptr);
+      memcpy(newptr, ptr, (oldSize < size) ? oldSize : size);
+    }
+    return newptr;
+  }
+  if (!isHeapPointer(ptr)) {
+    errno = EINVAL;
+    return NULL;
+  }
+  void * newptr = my::allocator::realloc(ptr, size);
+  if (!newptr) {
+    errno = ENOMEM;
+  }
+  return newptr;
+}
+
+EXPORT void * memalign(size_t alignment, size_t size) {
+  if (!isPowerOfTwo(alignment)) {
+    errno = EINVAL;
+    return NULL;
+  }
+  return alignedMalloc(alignment, size);
+}
+
+EXPORT void * aligned_alloc(size_t alignment, size_t size) {
+  return memalign(alignment, size);
+}
+
+EXPORT int posix_memalign(void ** memptr, size_t alignment, size_t size) {
+  if (!isPowerOfTwo(alignment) || alignment % sizeof(void *)) {
+    return EINVAL;
+  }
+  void * ptr = alignedMalloc(alignment, size);
+  if (!ptr) {
+    return ENOMEM;
+  }
+  *memptr = ptr;
+  return 0;
+}
+
+EXPORT void * valloc(size_t size) {
+  return alignedMalloc(getpagesize(), size);
+}
+
+EXPORT void * pvalloc(size_t size) {
+  size_t pageSize = getpagesize();
+  return alignedMalloc(pageSize, (size + pageSize - 1) & ~(pageSize - 1));
+}
+
+EXPORT size_t malloc_usable_size(void * ptr) {
+  if (!ptr) {
+    return 0;
+  }
+  if (isBootstrapPointer(ptr)) {
+    return bootstrapSize(ptr);
+  }
+  return isHeapPointer(ptr) ? my::allocator::usable_size(ptr) : 0;
+}
+
+}  // extern "C"
@@ -0,0 +1,75 @@
+/**
+ * Copyright (c) 2012 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+// preload.h - State shared by the C (preload.cpp) and C++ (new_delete.cpp) entry points of the
+// LD_PRELOAD build of the allocator.
+
+#ifndef _PRELOAD_H
+#define _PRELOAD_H
+
+#include <cstdlib>
+#include "./allocator_interface.h"
+
+// Marks the entry points that must stay visible outside the shared library
+#define EXPORT __attribute__((visibility("default")))
+
+// Size of the static arena that serves allocations made while the heap is being set up
+#define BOOTSTRAP_ARENA_SIZE (64 * 1024)
+
+// Alignment of bootstrap allocations; each one is preceded by this many bytes holding its size
+#define BOOTSTRAP_ALIGNMENT 16
+
+// The most blocks and spans that one pass of the background maintenance thread handles
+#define BACKGROUND_BUDGET 256
+
+enum HeapState { HEAP_UNINITIALIZED, HEAP_INITIALIZING, HEAP_READY };
+
+extern volatile int heapState;
+extern char bootstrapArena[BOOTSTRAP_ARENA_SIZE];
+
+void * bootstrapMalloc(size_t size);
+bool initializeHeap();
+
+// Helper method that sets up the heap on first use. Returns false if the heap cannot be used yet
+// because the calling thread is the one setting it up; the caller then falls back to bootstrapMalloc.
+static inline bool ensureHeapReady() {
+  return heapState == HEAP_READY || initializeHeap();
+}
+
+// Helper method that returns whether ptr was handed out by the bootstrap arena
+static inline bool isBootstrapPointer(void * ptr) {
+  return (char *) ptr >= bootstrapArena && (char *) ptr < bootstrapArena + BOOTSTRAP_ARENA_SIZE;
+}
+
+// Helper method that returns the size recorded for a bootstrap block
+static inline size_t bootstrapSize(void * ptr) {
+  return *(size_t *) ((char *) ptr - BOOTSTRAP_ALIGNMENT);
+}
+
+// Helper method that returns whether ptr lies in the managed heap, as recorded by the allocator's
+// page map. Pointers that are neither in the heap nor in the bootstrap arena were not handed out by
+// us and are left alone.
+static inline bool isHeapPointer(void * ptr) {
+  return heapState == HEAP_READY && my::allocator::owns(ptr);
+}
+
+#endif  // _PRELOAD_H
@@ -0,0 +1,203 @@
+#!/usr/bin/env python3
+
+'''
+  Size-class table generator for the 6.172 Memory Allocator
+
+  Reads the sizes that a program asks for, either from mdriver traces
+  (.rep files) or from histograms recorded in production (any other file,
+  with one "<size> <count>" pair per line and # comments), and writes
+  size_classes.h to standard output.
+
+  The allocator bins a free block by its size, and malloc starts its
+  search at the bin of the size it needs, walking past the blocks in that
+  bin that are too small. Block sizes below SIZE_CLASS_LIMIT are binned
+  by a table of SIZE_CLASS_COUNT classes, each starting at a lower bound.
+  Every block size below the exact limit has a class of its own, so that
+  small blocks always fit their bin whatever the profile. Above it, this
+  tool picks the lower bounds that minimize the expected number of bytes
+  by which a requested block exceeds the lower bound of its class, so
+  that the sizes asked for most often start classes of their own, and
+  every block in their bin fits them.
+
+  Usage: sizeclasses.py [options] file...
+    --classes N     number of classes below the limit (default 160)
+    --exact N       sizes below this get a class each (default 1024)
+    --limit N       table limit, a power of two (default 8192)
+    --smoothing F   fraction of the weight spread evenly over all sizes, so
+                    that sizes never seen still get reasonable classes
+                    (default 0.01)
+
+  Example: python3 sizeclasses.py traces/*-bal.rep > size_classes.h
+'''
+
+import getopt, sys
+
+# These must match allocator.cpp: a block holds its request plus
+# ALLOCATED_BLOCK_OVERHEAD bytes, rounded up to BLOCK_ALIGNMENT, and is at
+# least MINIMUM_ALLOCATED_BLOCK_SIZE big.
+ALLOCATED_BLOCK_OVERHEAD = 20
+BLOCK_ALIGNMENT = 8
+MINIMUM_ALLOCATED_BLOCK_SIZE = 40
+
+# The table is indexed by block size / TABLE_GRANULE
+TABLE_GRANULE = 8
+
+def block_size(size):
+  size = (size + ALLOCATED_BLOCK_OVERHEAD + BLOCK_ALIGNMENT - 1) // BLOCK_ALIGNMENT * BLOCK_ALIGNMENT
+  return max(size, MINIMUM_ALLOCATED_BLOCK_SIZE)
+
+# Adds the block sizes of the mallocs and reallocs in an mdriver trace to histogram
+def read_trace(filename, histogram):
+  with open(filename) as f:
+    lines = f.read().split('\n')[4:]
+  for line in lines:
+    fields = line.split()
+    if len(fields) == 3 and fields[0] in ('a', 'r'):
+      size = block_size(int(fields[2]))
+      histogram[size] = histogram.get(size, 0) + 1
+
+# Adds the block sizes of a "<size> <count>" histogram to histogram
+def read_histogram(filename, histogram):
+  with open(filename) as f:
+    for line in f:
+      fields = line.split('#')[0].split()
+      if len(fields) == 2:
+        size = block_size(int(fields[0]))
+        histogram[size] = histogram.get(size, 0) + float(fields[1])
+
+# Returns the lower bounds of the classes that minimize the weighted gap
+# between each size and the lower bound of its class. The first class
+# always starts at the smallest size.
+#
+# cost(i, j) is the gap of sizes[i:j] when sizes[i] starts their class.
+# It satisfies the quadrangle inequality, so the best start of the last
+# class only moves right as j does, and each layer of the dynamic program
+# is solved by divide and conquer in O(n log n).
+def choose_bounds(sizes, weights, classes):
+  n = len(sizes)
+  if classes >= n:
+    return list(sizes)
+  prefix_weight = [0.0] * (n + 1)
+  prefix_moment = [0.0] * (n + 1)
+  for k in range(n):
+    prefix_weight[k + 1] = prefix_weight[k] + weights[k]
+    prefix_moment[k + 1] = prefix_moment[k] + weights[k] * sizes[k]
+
+  def cost(i, j):
+    return (prefix_moment[j] - prefix_moment[i]) - sizes[i] * (prefix_weight[j] - prefix_weight[i])
+
+  INFINITY = float('inf')
+  # best[j]: least cost of sizes[:j] in the classes so far; start[c][j]: where the last of them starts
+  best = [cost(0, j) for j in range(n + 1)]
+  starts = [[0] * (n + 1)]
+  for c in range(1, classes):
+    previous = best
+    best = [INFINITY] * (n + 1)
+    start = [0] * (n + 1)
+    # Solve j in [lo, hi) knowing that the best start lies in [optlo, opthi]
+    stack = [(c + 1, n + 1, c, n - 1)]
+    while stack:
+      lo, hi, optlo, opthi = stack.pop()
+      if lo >= hi:
+        continue
+      j = (lo + hi) // 2
+      for i in range(optlo, min(j - 1, opthi) + 1):
+        value = previous[i] + cost(i, j)
+        if value < best[j]:
+          best[j] = value
+          start[j] = i
+      stack.append((lo, j, optlo, start[j]))
+      stack.append((j + 1, hi, start[j], opthi))
+    starts.append(start)
+
+  bounds = []
+  j = n
+  for c in range(classes - 1, 0, -1):
+    i = starts[c][j]
+    bounds.append(sizes[i])
+    j = i
+  bounds.append(sizes[0])
+  return bounds[::-1]
+
+# Returns the weighted mean gap between each size and the lower bound of its class
+def mean_gap(sizes, weights, bounds):
+  total = 0.0
+  c = 0
+  for size, weight in zip(sizes, weights):
+    while c + 1 < len(bounds) and bounds[c + 1] <= size:
+      c += 1
+    total += weight * (size - bounds[c])
+  return total / sum(weights)
+
+def main():
+  classes = 160
+  exact = 1024
+  limit = 8192
+  smoothing = 0.01
+  opts, files = getopt.getopt(sys.argv[1:], '', ['classes=', 'exact=', 'limit=', 'smoothing='])
+  for opt, value in opts:
+    if opt == '--classes':
+      classes = int(value)
+    elif opt == '--exact':
+      exact = int(value)
+    elif opt == '--limit':
+      limit = int(value)
+    elif opt == '--smoothing':
+      smoothing = float(value)
+  exact_sizes = list(range(MINIMUM_ALLOCATED_BLOCK_SIZE, min(exact, limit), TABLE_GRANULE))
+  if not files or limit & (limit - 1) or classes <= len(exact_sizes) or classes > 256:
+    sys.stderr.write(__doc__)
+    sys.exit(1)
+
+  histogram = {}
+  for filename in files:
+    if filename.endswith('.rep'):
+      read_trace(filename, histogram)
+    else:
+      read_histogram(filename, histogram)
+
+  # Only the sizes above the exact ones are profiled
+  sizes = list(range(MINIMUM_ALLOCATED_BLOCK_SIZE + len(exact_sizes) * TABLE_GRANULE, limit, TABLE_GRANULE))
+  observed = sum(histogram.get(size, 0) for size in sizes)
+  spread = max(observed, 1) * smoothing / len(sizes)
+  weights = [histogram.get(size, 0) + spread for size in sizes]
+  profiled = choose_bounds(sizes, weights, classes - len(exact_sizes))
+  uniform = [sizes[len(sizes) * c // len(profiled)] for c in range(len(profiled))]
+  bounds = exact_sizes + profiled
+
+  table = []
+  c = 0
+  for granule in range(limit // TABLE_GRANULE):
+    while c + 1 < len(bounds) and bounds[c + 1] <= granule * TABLE_GRANULE:
+      c += 1
+    table.append(c)
+
+  shift = limit.bit_length() - 1
+  out = sys.stdout
+  out.write('// size_classes.h - Generated by sizeclasses.py; do not edit. Regenerate it with make sizeclasses.\n')
+  out.write('//\n')
+  out.write('// Profiled from %s\n' % ' '.join(files))
+  out.write('// Sizes below %d have a class each. %d block sizes from there to %d observed; the mean gap between a\n'
+            % (exact, observed, limit))
+  out.write('// block size and the lower bound of its class is %.1f bytes, against %.1f bytes for %d evenly spaced\n'
+            % (mean_gap(sizes, weights, profiled), mean_gap(sizes, weights, uniform), len(profiled)))
+  out.write('// classes.\n')
+  out.write('\n#ifndef _SIZE_CLASSES_H\n#define _SIZE_CLASSES_H\n\n#include <stdint.h>\n\n')
+  out.write('// Block sizes below SIZE_CLASS_LIMIT are binned by the table, in SIZE_CLASS_COUNT classes\n')
+  out.write('#define SIZE_CLASS_LIMIT_SHIFT %d\n' % shift)
+  out.write('#define SIZE_CLASS_LIMIT (1 << SIZE_CLASS_LIMIT_SHIFT)\n')
+  out.write('#define SIZE_CLASS_COUNT %d\n' % len(bounds))
+  out.write('#define SIZE_CLASS_GRANULE %d\n\nnamespace my {\n\n' % TABLE_GRANULE)
+  out.write('// The lower bound of each class\n')
+  out.write('constexpr uint32_t sizeClassBounds[SIZE_CLASS_COUNT] = {\n')
+  for k in range(0, len(bounds), 12):
+    out.write('  ' + ', '.join('%d' % b for b in bounds[k:k + 12]) + ',\n')
+  out.write('};\n\n')
+  out.write('// The class of each block size below SIZE_CLASS_LIMIT, indexed by size / SIZE_CLASS_GRANULE\n')
+  out.write('constexpr uint8_t sizeClassTable[SIZE_CLASS_LIMIT / SIZE_CLASS_GRANULE] = {\n')
+  for k in range(0, len(table), 16):
+    out.write('  ' + ', '.join('%d' % t for t in table[k:k + 16]) + ',\n')
+  out.write('};\n\n};\n#endif  // _SIZE_CLASSES_H\n')
+
+if __name__ == '__main__':
+  main()
@@ -0,0 +1,149 @@
+/**
+ * Copyright (c) 2012 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+#ifndef _STL_ALLOCATOR_H
+#define _STL_ALLOCATOR_H
+
+#include <cstddef>
+#include <new>
+#if __cplusplus >= 201703L
+#include <memory_resource>
+#endif
+#include "./allocator_interface.h"
+
+// Both adapters call straight into my::allocator, so the heap must already have been set up
+// (mem_init and allocator::init, e.g. through my_malloc_init) before a container uses them.
+
+namespace my {
+
+// An std::allocator-compatible adapter. Deallocation ignores the size the container passes:
+// every block carries its size in its header, so allocator::free does not need it.
+template <class T>
+class stl_allocator {
+public:
+  typedef T value_type;
+  typedef T * pointer;
+  typedef const T * const_pointer;
+  typedef T & reference;
+  typedef const T & const_reference;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+
+  template <class U>
+  struct rebind {
+    typedef stl_allocator<U> other;
+  };
+
+  stl_allocator() {}
+  template <class U>
+  stl_allocator(const stl_allocator<U> &) {}
+
+  pointer allocate(size_type n, const void * = 0) {
+    // n * sizeof(T) would wrap around
+    if (n > max_size()) {
+#if __cplusplus >= 201103L
+      throw std::bad_array_new_length();
+#else
+      throw std::bad_alloc();
+#endif
+    }
+    void * p = allocator::memalign(__alignof__(T), n * sizeof(T));
+    if (!p) {
+      throw std::bad_alloc();
+    }
+    return (pointer) p;
+  }
+
+  void deallocate(pointer p, size_type n) {
+    allocator::free(p);
+  }
+
+  size_type max_size() const {
+    return ((size_type) -1) / sizeof(T);
+  }
+
+  pointer address(reference x) const {
+    return &x;
+  }
+
+  const_pointer address(const_reference x) const {
+    return &x;
+  }
+
+  void construct(pointer p, const_reference value) {
+    new ((void *) p) T(value);
+  }
+
+  void destroy(pointer p) {
+    p->~T();
+  }
+};
+
+// All stl_allocators draw from the same heap, so memory allocated by one can be freed by any other
+template <class T, class U>
+inline bool operator==(const stl_allocator<T> &, const stl_allocator<U> &) {
+  return true;
+}
+
+template <class T, class U>
+inline bool operator!=(const stl_allocator<T> &, const stl_allocator<U> &) {
+  return false;
+}
+
+#if __cplusplus >= 201703L
+// An std::pmr::memory_resource backed by my::allocator. Like stl_allocator, it ignores the size
+// passed to deallocation.
+class memory_resource : public std::pmr::memory_resource {
+protected:
+  void * do_allocate(size_t bytes, size_t alignment) {
+    void * p = allocator::memalign(alignment, bytes);
+    if (!p) {
+      throw std::bad_alloc();
+    }
+    return p;
+  }
+
+  void do_deallocate(void * p, size_t bytes, size_t alignment) {
+    allocator::free(p);
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource & other) const noexcept {
+    return dynamic_cast<const memory_resource *>(&other) != NULL;
+  }
+};
+
+// Returns the process-wide memory_resource instance
+inline memory_resource * get_memory_resource() {
+  static memory_resource resource;
+  return &resource;
+}
+
+// A monotonic arena whose chunks come from my::allocator. Deallocation is a no-op; everything
+// is handed back to the allocator at once by release() or when the arena is destroyed.
+class monotonic_resource : public std::pmr::monotonic_buffer_resource {
+public:
+  explicit monotonic_resource(size_t initialSize = 64 * 1024)
+    : std::pmr::monotonic_buffer_resource(initialSize, get_memory_resource()) {}
+};
+#endif
+};
+#endif  // _STL_ALLOCATOR_H
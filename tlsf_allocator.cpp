@@ -0,0 +1,428 @@
+/**
+ * Copyright (c) 2012 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+#include <limits.h>
+#include <cstdlib>
+#include <cstring>
+#include "./allocator_interface.h"
+#include "./memlib.h"
+
+// tlsf_allocator.cpp - A two-level segregated fit allocator, whose malloc and free take constant time.
+//
+// Free blocks are kept in lists indexed by two levels: the first level is the power of two below the block's size,
+// and the second splits each power-of-two range into TLSF_SL_COUNT equal parts. A bitmap of the non-empty first
+// levels, and one of the non-empty lists within each first level, let malloc find a list whose blocks are all large
+// enough with two find-first-set instructions, so it never walks a list. Blocks carry boundary tags and are
+// coalesced with their neighbours as soon as they are freed, and the heap ends with an empty allocated block so that
+// the last block always has a successor.
+
+// log2 of the number of second-level lists per first level
+#define TLSF_SL_SHIFT 4
+#define TLSF_SL_COUNT (1 << TLSF_SL_SHIFT)
+
+// Blocks sizes are multiples of 8 bytes. Blocks below TLSF_SMALL_BLOCK all map to the first first level, which is
+// split into lists 8 bytes apart.
+#define TLSF_ALIGN_SHIFT 3
+#define TLSF_FL_SHIFT (TLSF_SL_SHIFT + TLSF_ALIGN_SHIFT)
+#define TLSF_SMALL_BLOCK (1 << TLSF_FL_SHIFT)
+
+// mem_sbrk takes an int, so blocks stay below 2 GB
+#define TLSF_FL_MAX 31
+#define TLSF_FL_COUNT (TLSF_FL_MAX - TLSF_FL_SHIFT + 1)
+#define TLSF_MAX_BLOCK (((size_t) 1 << TLSF_FL_MAX) - TLSF_SMALL_BLOCK)
+
+// Flags kept in the low bits of a block's size
+#define TLSF_FREE 1
+#define TLSF_PREVIOUS_FREE 2
+#define TLSF_FLAGS (TLSF_FREE | TLSF_PREVIOUS_FREE)
+
+namespace my {
+
+// A block of the heap. The links are only present while the block is free, and overlap its payload.
+struct TlsfBlock {
+  size_t sizeAndFlags; // size of the entire block including the header, and the TLSF_FREE and TLSF_PREVIOUS_FREE flags
+  TlsfBlock * nextFreeBlock; // next free block in the same list
+  TlsfBlock * previousFreeBlock; // previous free block in the same list
+};
+
+// The header that precedes the payload of every block
+#define TLSF_HEADER_SIZE (sizeof(size_t))
+
+// A free block ends with a footer that points back at its header, for the block after it to coalesce with
+#define TLSF_MIN_BLOCK (sizeof(TlsfBlock) + sizeof(TlsfBlock *))
+
+// The start of the heap, and the empty block that ends it (NULL while the heap is empty)
+static char * heapBase;
+static TlsfBlock * heapEnd;
+
+// The two levels of bitmaps, and the free lists they describe
+static uint32_t firstLevelBitmap;
+static uint32_t secondLevelBitmaps[TLSF_FL_COUNT];
+static TlsfBlock * freeLists[TLSF_FL_COUNT][TLSF_SL_COUNT];
+
+// Helper method that returns the size of a block
+static inline size_t getSize(TlsfBlock * tb) {
+  return tb->sizeAndFlags & ~(size_t) TLSF_FLAGS;
+}
+
+// Helper method that sets the size of a block, keeping its flags
+static inline void setSize(TlsfBlock * tb, size_t size) {
+  tb->sizeAndFlags = size | (tb->sizeAndFlags & TLSF_FLAGS);
+}
+
+// Helper method that returns the block that physically follows a block
+static inline TlsfBlock * getNextBlock(TlsfBlock * tb) {
+  return (TlsfBlock *) ((char *) tb + getSize(tb));
+}
+
+// Helper method that returns the free block that physically precedes a block whose TLSF_PREVIOUS_FREE flag is set
+static inline TlsfBlock * getPreviousBlock(TlsfBlock * tb) {
+  return *((TlsfBlock **) tb - 1);
+}
+
+// Helper method that marks a block free or allocated, along with the TLSF_PREVIOUS_FREE flag of the block after it.
+// A free block also gets its footer.
+static inline void setFree(TlsfBlock * tb, bool isFree) {
+  TlsfBlock * next = getNextBlock(tb);
+  if (isFree) {
+    tb->sizeAndFlags |= TLSF_FREE;
+    next->sizeAndFlags |= TLSF_PREVIOUS_FREE;
+    *((TlsfBlock **) next - 1) = tb;
+  } else {
+    tb->sizeAndFlags &= ~(size_t) TLSF_FREE;
+    next->sizeAndFlags &= ~(size_t) TLSF_PREVIOUS_FREE;
+  }
+}
+
+// Helper method that returns the index of the most significant set bit of a nonzero size
+static inline int getHighestBit(size_t size) {
+  return 63 - __builtin_clzl(size);
+}
+
+// Helper method that returns the two levels of the list that a free block of the given size belongs to
+static inline void getListIndex(size_t size, int * firstLevel, int * secondLevel) {
+  if (size < TLSF_SMALL_BLOCK) {
+    *firstLevel = 0;
+    *secondLevel = (int) (size >> TLSF_ALIGN_SHIFT);
+  } else {
+    int bit = getHighestBit(size);
+    *firstLevel = bit - TLSF_FL_SHIFT + 1;
+    *secondLevel = (int) (size >> (bit - TLSF_SL_SHIFT)) ^ TLSF_SL_COUNT;
+  }
+}
+
+// Helper method that returns the two levels of the first list whose blocks are all at least the given size. Sizes
+// are rounded up to the next list boundary, so the first block of any list at or after it is a good fit.
+static inline void getSearchIndex(size_t size, int * firstLevel, int * secondLevel) {
+  if (size >= TLSF_SMALL_BLOCK) {
+    size += ((size_t) 1 << (getHighestBit(size) - TLSF_SL_SHIFT)) - 1;
+  }
+  getListIndex(size, firstLevel, secondLevel);
+}
+
+// Helper method that adds a free block to the list for its size
+static inline void addBlockToFreeList(TlsfBlock * tb) {
+  int firstLevel, secondLevel;
+  getListIndex(getSize(tb), &firstLevel, &secondLevel);
+  TlsfBlock * head = freeLists[firstLevel][secondLevel];
+  tb->nextFreeBlock = head;
+  tb->previousFreeBlock = NULL;
+  if (head) {
+    head->previousFreeBlock = tb;
+  }
+  freeLists[firstLevel][secondLevel] = tb;
+  firstLevelBitmap |= 1U << firstLevel;
+  secondLevelBitmaps[firstLevel] |= 1U << secondLevel;
+}
+
+// Helper method that removes a free block from the list for its size
+static inline void removeBlockFromFreeList(TlsfBlock * tb) {
+  int firstLevel, secondLevel;
+  getListIndex(getSize(tb), &firstLevel, &secondLevel);
+  if (tb->nextFreeBlock) {
+    tb->nextFreeBlock->previousFreeBlock = tb->previousFreeBlock;
+  }
+  if (tb->previousFreeBlock) {
+    tb->previousFreeBlock->nextFreeBlock = tb->nextFreeBlock;
+  } else {
+    freeLists[firstLevel][secondLevel] = tb->nextFreeBlock;
+    if (!tb->nextFreeBlock) {
+      secondLevelBitmaps[firstLevel] &= ~(1U << secondLevel);
+      if (!secondLevelBitmaps[firstLevel]) {
+        firstLevelBitmap &= ~(1U << firstLevel);
+      }
+    }
+  }
+}
+
+// Helper method that takes a free block of at least the given size out of its list, or returns NULL if there is none
+static inline TlsfBlock * takeSuitableBlock(size_t size) {
+  int firstLevel, secondLevel;
+  getSearchIndex(size, &firstLevel, &secondLevel);
+  if (firstLevel >= TLSF_FL_COUNT) {
+    return NULL;
+  }
+  uint32_t secondLevelMap = secondLevelBitmaps[firstLevel] & (~0U << secondLevel);
+  if (!secondLevelMap) {
+    uint32_t firstLevelMap = firstLevel + 1 < 32 ? firstLevelBitmap & (~0U << (firstLevel + 1)) : 0;
+    if (!firstLevelMap) {
+      return NULL;
+    }
+    firstLevel = __builtin_ctz(firstLevelMap);
+    secondLevelMap = secondLevelBitmaps[firstLevel];
+  }
+  TlsfBlock * tb = freeLists[firstLevel][__builtin_ctz(secondLevelMap)];
+  removeBlockFromFreeList(tb);
+  return tb;
+}
+
+// Helper method that frees a block, coalescing it with the free blocks on either side of it
+static inline void releaseBlock(TlsfBlock * tb) {
+  TlsfBlock * next = getNextBlock(tb);
+  if (next->sizeAndFlags & TLSF_FREE) {
+    removeBlockFromFreeList(next);
+    setSize(tb, getSize(tb) + getSize(next));
+  }
+  if (tb->sizeAndFlags & TLSF_PREVIOUS_FREE) {
+    TlsfBlock * previous = getPreviousBlock(tb);
+    removeBlockFromFreeList(previous);
+    setSize(previous, getSize(previous) + getSize(tb));
+    tb = previous;
+  }
+  setFree(tb, true);
+  addBlockToFreeList(tb);
+}
+
+// Helper method that cuts an allocated block down to the given size, freeing the rest if it can hold a block
+static inline void truncateBlock(TlsfBlock * tb, size_t size) {
+  size_t rest = getSize(tb) - size;
+  if (rest < TLSF_MIN_BLOCK) {
+    return;
+  }
+  setSize(tb, size);
+  TlsfBlock * remainder = getNextBlock(tb);
+  remainder->sizeAndFlags = rest;
+  releaseBlock(remainder);
+}
+
+// Helper method that extends the heap by the given number of bytes. The block that ended the heap becomes an
+// allocated block that spans them, and is returned. Returns NULL if the heap cannot be extended.
+static inline TlsfBlock * extendHeap(size_t size) {
+  if (size > INT_MAX - TLSF_HEADER_SIZE) {
+    return NULL;
+  }
+  void * p = mem_sbrk((int) (heapEnd ? size : size + TLSF_HEADER_SIZE));
+  if (p == (void *) -1) {
+    return NULL;
+  }
+  if (!heapEnd) {
+    heapBase = (char *) p;
+    heapEnd = (TlsfBlock *) p;
+    heapEnd->sizeAndFlags = 0;
+  } else {
+    assert((char *) p == (char *) heapEnd + TLSF_HEADER_SIZE);
+  }
+  TlsfBlock * tb = heapEnd;
+  setSize(tb, size);
+  heapEnd = getNextBlock(tb);
+  heapEnd->sizeAndFlags = 0;
+  return tb;
+}
+
+// Helper method that returns the size of the block that holds size bytes of payload, or 0 if it is too large
+static inline size_t getBlockSize(size_t size) {
+  if (size > TLSF_MAX_BLOCK) {
+    return 0;
+  }
+  size_t blockSize = (size + TLSF_HEADER_SIZE + (1 << TLSF_ALIGN_SHIFT) - 1) & ~(size_t) ((1 << TLSF_ALIGN_SHIFT) - 1);
+  return blockSize < TLSF_MIN_BLOCK ? TLSF_MIN_BLOCK : blockSize;
+}
+
+// tlsf_init - Empties the heap.
+int tlsf_allocator::init() {
+  heapBase = NULL;
+  heapEnd = NULL;
+  firstLevelBitmap = 0;
+  memset(secondLevelBitmaps, 0, sizeof(secondLevelBitmaps));
+  memset(freeLists, 0, sizeof(freeLists));
+  return 0;
+}
+
+// tlsf_check - Walks the heap and the free lists, and checks the boundary tags, that no two free blocks are
+// adjacent, and that the free lists and bitmaps hold exactly the free blocks, each in the list for its size.
+int tlsf_allocator::check() {
+  size_t freeBlocks = 0;
+  bool previousFree = false;
+  if (heapEnd) {
+    for (TlsfBlock * tb = (TlsfBlock *) heapBase; tb != heapEnd; tb = getNextBlock(tb)) {
+      if (getSize(tb) < TLSF_MIN_BLOCK || (char *) getNextBlock(tb) > (char *) heapEnd) {
+        printf("Block %p has size %zu\n", tb, getSize(tb));
+        return -1;
+      }
+      if (((tb->sizeAndFlags & TLSF_PREVIOUS_FREE) != 0) != previousFree) {
+        printf("Block %p has a TLSF_PREVIOUS_FREE flag that disagrees with the block before it\n", tb);
+        return -1;
+      }
+      previousFree = tb->sizeAndFlags & TLSF_FREE;
+      if (previousFree) {
+        if (tb->sizeAndFlags & TLSF_PREVIOUS_FREE) {
+          printf("Free block %p was not coalesced with the free block before it\n", tb);
+          return -1;
+        }
+        if (getPreviousBlock(getNextBlock(tb)) != tb) {
+          printf("Free block %p has a footer that does not point at it\n", tb);
+          return -1;
+        }
+        freeBlocks++;
+      }
+    }
+    if (((heapEnd->sizeAndFlags & TLSF_PREVIOUS_FREE) != 0) != previousFree || getSize(heapEnd) != 0) {
+      printf("The block that ends the heap is not an empty block that knows whether the last block is free\n");
+      return -1;
+    }
+  }
+
+  size_t listedBlocks = 0;
+  for (int firstLevel = 0; firstLevel < TLSF_FL_COUNT; firstLevel++) {
+    if (((firstLevelBitmap >> firstLevel) & 1) != (secondLevelBitmaps[firstLevel] != 0)) {
+      printf("The first-level bitmap disagrees with second-level bitmap %d\n", firstLevel);
+      return -1;
+    }
+    for (int secondLevel = 0; secondLevel < TLSF_SL_COUNT; secondLevel++) {
+      TlsfBlock * previous = NULL;
+      TlsfBlock * tb = freeLists[firstLevel][secondLevel];
+      if (((secondLevelBitmaps[firstLevel] >> secondLevel) & 1) != (tb != NULL)) {
+        printf("Second-level bitmap %d disagrees with free list %d\n", firstLevel, secondLevel);
+        return -1;
+      }
+      for (; tb; previous = tb, tb = tb->nextFreeBlock) {
+        int blockFirstLevel, blockSecondLevel;
+        getListIndex(getSize(tb), &blockFirstLevel, &blockSecondLevel);
+        if (!(tb->sizeAndFlags & TLSF_FREE) || tb->previousFreeBlock != previous ||
+            blockFirstLevel != firstLevel || blockSecondLevel != secondLevel) {
+          printf("Free list %d/%d contains a block %p that is not linked as a free block of that list\n",
+                 firstLevel, secondLevel, tb);
+          return -1;
+        }
+        listedBlocks++;
+      }
+    }
+  }
+  if (listedBlocks != freeBlocks) {
+    printf("The free lists hold %zu blocks but the heap has %zu\n", listedBlocks, freeBlocks);
+    return -1;
+  }
+  return 0;
+}
+
+// tlsf_malloc - Takes a free block from the first list whose blocks all fit, extending the heap if there is none,
+// and frees what it does not need.
+void * tlsf_allocator::malloc(size_t size) {
+  size_t blockSize = getBlockSize(size);
+  if (!blockSize) {
+    return NULL;
+  }
+  TlsfBlock * tb = takeSuitableBlock(blockSize);
+  if (!tb && heapEnd && (heapEnd->sizeAndFlags & TLSF_PREVIOUS_FREE)) {
+    // Take the last block, extending the heap just enough for it to fit
+    tb = getPreviousBlock(heapEnd);
+    TlsfBlock * extension = NULL;
+    if (getSize(tb) < blockSize && !(extension = extendHeap(blockSize - getSize(tb)))) {
+      return NULL;
+    }
+    removeBlockFromFreeList(tb);
+    if (extension) {
+      setSize(tb, getSize(tb) + getSize(extension));
+    }
+  } else if (!tb && !(tb = extendHeap(blockSize))) {
+    return NULL;
+  }
+  setFree(tb, false);
+  truncateBlock(tb, blockSize);
+  return (char *) tb + TLSF_HEADER_SIZE;
+}
+
+// tlsf_free - Frees the block and coalesces it with its neighbours.
+void tlsf_allocator::free(void *ptr) {
+  if (!ptr) {
+    return;
+  }
+  releaseBlock((TlsfBlock *) ((char *) ptr - TLSF_HEADER_SIZE));
+}
+
+// tlsf_realloc - Shrinks the block in place, or grows it into the free block after it (and past the end of the
+// heap when it is the last block), and otherwise moves it.
+void * tlsf_allocator::realloc(void *ptr, size_t size) {
+  if (!ptr) {
+    return malloc(size);
+  }
+  size_t blockSize = getBlockSize(size);
+  if (!blockSize) {
+    return NULL;
+  }
+  TlsfBlock * tb = (TlsfBlock *) ((char *) ptr - TLSF_HEADER_SIZE);
+  TlsfBlock * next = getNextBlock(tb);
+  if (getSize(tb) < blockSize && (next->sizeAndFlags & TLSF_FREE) &&
+      (getSize(tb) + getSize(next) >= blockSize || getNextBlock(next) == heapEnd)) {
+    removeBlockFromFreeList(next);
+    setSize(tb, getSize(tb) + getSize(next));
+    setFree(tb, false);
+    next = getNextBlock(tb);
+  }
+  if (getSize(tb) < blockSize && next == heapEnd) {
+    TlsfBlock * extension = extendHeap(blockSize - getSize(tb));
+    if (extension) {
+      setSize(tb, getSize(tb) + getSize(extension));
+    }
+  }
+  if (getSize(tb) >= blockSize) {
+    truncateBlock(tb, blockSize);
+    return ptr;
+  }
+
+  void * newptr = malloc(size);
+  if (!newptr) {
+    return NULL;
+  }
+  memcpy(newptr, ptr, getSize(tb) - TLSF_HEADER_SIZE);
+  free(ptr);
+  return newptr;
+}
+
+// call mem_reset_brk.
+void tlsf_allocator::reset_brk() {
+  mem_reset_brk();
+}
+
+// call mem_heap_lo
+void * tlsf_allocator::heap_lo() {
+  return mem_heap_lo();
+}
+
+// call mem_heap_hi
+void * tlsf_allocator::heap_hi() {
+  return mem_heap_hi();
+}
+};
@@ -168,6 +168,7 @@ int eval_mm_valid(Type *impl, trace_t *trace, int tracenum) {
       case ALLOC:  // malloc
 
         // Call the student's malloc
+        set_site<Type>(size);
         if ((p = (char *) impl->malloc(size)) == NULL) {
           malloc_error(tracenum, i, "impl malloc failed.");
           return 0;
@@ -196,6 +197,7 @@ int eval_mm_valid(Type *impl, trace_t *trace, int tracenum) {
 
         // Call the student's realloc
         oldp = trace->blocks[index];
+        set_site<Type>(size);
         if ((newp = (char *) impl->realloc(oldp, size)) == NULL) {
           malloc_error(tracenum, i, "impl realloc failed.");
           return 0;
@@ -13,12 +13,18 @@
 #include <sstream>
 #include <pthread.h>
 #include "allocator.cpp"
+#include "perfctr.h"
 
 #include <unistd.h>
 
 static pthread_mutex_t my_malloc_mutex = PTHREAD_MUTEX_INITIALIZER;
 static bool is_my_malloc_initialized = false;
 
+// Counts the dTLB misses and page faults of the whole benchmark, reported by end_program
+__attribute__((constructor)) static void start_counters() {
+  perfctr_start();
+}
+
 #ifdef VALIDATE
 static int seq = 0;
 
@@ -115,6 +121,10 @@ void *my_malloc(size_t size)
     my_malloc_init();
   }
 
+#ifdef LIFETIME_HEAPS
+  // Name the caller as the allocation site, which would otherwise be this wrapper for every block
+  my::allocator::set_allocation_site((size_t) __builtin_return_address(0));
+#endif
   void* ret = my::allocator::malloc(size);
 
 #ifdef VALIDATE
@@ -183,8 +193,19 @@ void end_thread() {
 }
 
 void end_program() {
+  long long tlbMisses = perfctr_read(PERFCTR_DTLB_MISSES);
+  long long pageFaults = perfctr_read(PERFCTR_PAGE_FAULTS);
+  if (tlbMisses >= 0) {
+    std::cerr << "dTLB misses: " << tlbMisses << "\n";
+  } else {
+    std::cerr << "dTLB misses: unavailable\n";
+  }
+  if (pageFaults >= 0) {
+    std::cerr << "Page faults: " << pageFaults << "\n";
+  }
 #ifdef MYMALLOC
-  std::cerr << "Heap size: " << mem_heapsize() << "\n";
+  std::cerr << "Heap size: " << mem_heapsize() << (mem_hugepages() ? " (huge pages)" : "") << "\n";
+  std::cerr << "Committed: " << mem_committed() << "\n";
 
 #ifdef VALIDATE
 #ifdef USE_ONE_LOG